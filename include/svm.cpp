@@ -7,6 +7,13 @@
 #include <stdarg.h>
 #include <limits.h>
 #include <locale.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <vector>
+#include "Eigen/Core"
 #include "svm.h"
 int libsvm_version = LIBSVM_VERSION;
 typedef float Qfloat;
@@ -58,6 +65,167 @@ static void info(const char *fmt,...)
 static void info(const char *fmt,...) {}
 #endif
 
+//
+// Fork-join pool for kernel columns. Several callers (e.g. concurrent
+// cross validation folds) can share it; each caller works on its own
+// range too, so a busy pool never blocks it.
+//
+static int svm_num_threads = 0;	// 0: one per hardware thread
+
+static int thread_count()
+{
+	int n = svm_num_threads > 0 ? svm_num_threads : (int)std::thread::hardware_concurrency();
+	return n > 0 ? n : 1;
+}
+
+class ThreadPool
+{
+public:
+	explicit ThreadPool(int workers) : stop(false)
+	{
+		for(int i=0;i<workers;i++)
+			threads.push_back(std::thread(&ThreadPool::work, this));
+	}
+	~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stop = true;
+		}
+		work_cv.notify_all();
+		for(size_t i=0;i<threads.size();i++)
+			threads[i].join();
+	}
+	int size() const { return (int)threads.size() + 1; }
+	// body(b, e) over [begin, end) in chunks of grain, returns when all are done
+	void run(int begin, int end, int grain, const std::function<void(int,int)>& body);
+private:
+	struct Job
+	{
+		const std::function<void(int,int)> *body;
+		int end, grain;
+		std::atomic<int> next;
+		int users;	// threads inside chunks(), guarded by mutex
+	};
+	std::vector<std::thread> threads;
+	std::mutex mutex;
+	std::condition_variable work_cv, done_cv;
+	std::vector<Job *> jobs;
+	bool stop;
+
+	static void chunks(Job *job)
+	{
+		for(;;)
+		{
+			int b = job->next.fetch_add(job->grain);
+			if(b >= job->end)
+				return;
+			(*job->body)(b, min(b + job->grain, job->end));
+		}
+	}
+	// Once a job is out of chunks nobody may pick it up again
+	void retire(Job *job)
+	{
+		for(size_t i=0;i<jobs.size();i++)
+			if(jobs[i] == job)
+			{
+				jobs.erase(jobs.begin() + i);
+				break;
+			}
+	}
+	void work()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		for(;;)
+		{
+			work_cv.wait(lock, [this]{ return stop || !jobs.empty(); });
+			if(stop)
+				return;
+			Job *job = jobs.back();
+			job->users++;
+			lock.unlock();
+			chunks(job);
+			lock.lock();
+			retire(job);
+			if(--job->users == 0)
+				done_cv.notify_all();
+		}
+	}
+};
+
+void ThreadPool::run(int begin, int end, int grain, const std::function<void(int,int)>& body)
+{
+	Job job;
+	job.body = &body;
+	job.end = end;
+	job.grain = grain;
+	job.next = begin;
+	job.users = 1;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		jobs.push_back(&job);
+	}
+	work_cv.notify_all();
+	chunks(&job);
+
+	std::unique_lock<std::mutex> lock(mutex);
+	retire(&job);
+	job.users--;
+	done_cv.wait(lock, [&job]{ return job.users == 0; });
+}
+
+static std::mutex pool_mutex;
+static ThreadPool *pool = NULL;
+
+static ThreadPool *get_pool()
+{
+	std::lock_guard<std::mutex> lock(pool_mutex);
+	if(pool == NULL)
+		pool = new ThreadPool(thread_count() - 1);
+	return pool;
+}
+
+void svm_set_num_threads(int n)
+{
+	std::lock_guard<std::mutex> lock(pool_mutex);
+	svm_num_threads = n;
+	delete pool;
+	pool = NULL;
+}
+
+static void (*external_parallel_for)(int, int, int, void (*)(void *, int, int), void *) = NULL;
+
+void svm_set_parallel_for(void (*run)(int, int, int, void (*)(void *, int, int), void *))
+{
+	external_parallel_for = run;
+}
+
+static void call_body(void *ctx, int b, int e)
+{
+	(*(const std::function<void(int,int)> *)ctx)(b, e);
+}
+
+// Ranges shorter than two grains run on the caller alone
+static void parallel_for(int begin, int end, int min_grain, const std::function<void(int,int)>& body)
+{
+	if(external_parallel_for && end - begin >= 2 * min_grain)
+	{
+		external_parallel_for(begin, end, min_grain, call_body, (void *)&body);
+		return;
+	}
+	ThreadPool *p = end - begin >= 2 * min_grain ? get_pool() : NULL;
+	if(p == NULL || p->size() == 1)
+	{
+		if(begin < end)
+			body(begin, end);
+		return;
+	}
+	p->run(begin, end, max(min_grain, (end - begin) / (4 * p->size())), body);
+}
+
+// Kernel values of one Q column per chunk
+#define KERNEL_GRAIN 256
+
 //
 // Kernel Cache
 //
@@ -211,6 +379,7 @@ public:
 	virtual void swap_index(int i, int j) const	// no so const...
 	{
 		swap(x[i],x[j]);
+		if(dense_x) swap(dense_x[i],dense_x[j]);
 		if(x_square) swap(x_square[i],x_square[j]);
 	}
 protected:
@@ -221,6 +390,13 @@ private:
 	const svm_node **x;
 	double *x_square;
 
+	// Rows as dense doubles when the data is not too sparse, so dot
+	// products are SIMD loops instead of index merges. Double like the
+	// sparse path, RBF's x_square[i]+x_square[j]-2*dot cancels in float
+	double *dense;
+	const double **dense_x;
+	int dense_dim;
+
 	// svm_parameter
 	const int kernel_type;
 	const int degree;
@@ -228,21 +404,28 @@ private:
 	const double coef0;
 
 	static double dot(const svm_node *px, const svm_node *py);
-	double kernel_linear(int i, int j) const
+	double dot(int i, int j) const
 	{
+		if(dense_x)
+			return Eigen::Map<const Eigen::VectorXd>(dense_x[i],dense_dim).dot(
+				Eigen::Map<const Eigen::VectorXd>(dense_x[j],dense_dim));
 		return dot(x[i],x[j]);
 	}
+	double kernel_linear(int i, int j) const
+	{
+		return dot(i,j);
+	}
 	double kernel_poly(int i, int j) const
 	{
-		return powi(gamma*dot(x[i],x[j])+coef0,degree);
+		return powi(gamma*dot(i,j)+coef0,degree);
 	}
 	double kernel_rbf(int i, int j) const
 	{
-		return exp(-gamma*(x_square[i]+x_square[j]-2*dot(x[i],x[j])));
+		return exp(-gamma*(x_square[i]+x_square[j]-2*dot(i,j)));
 	}
 	double kernel_sigmoid(int i, int j) const
 	{
-		return tanh(gamma*dot(x[i],x[j])+coef0);
+		return tanh(gamma*dot(i,j)+coef0);
 	}
 	double kernel_precomputed(int i, int j) const
 	{
@@ -275,11 +458,46 @@ Kernel::Kernel(int l, svm_node * const * x_, const svm_parameter& param)
 
 	clone(x,x_,l);
 
+	dense = 0;
+	dense_x = 0;
+	dense_dim = 0;
+	if(kernel_type != PRECOMPUTED)
+	{
+		// Dense pays off unless rows are mostly zeros, e.g. 784 pixel
+		// digits with ~150 set; capped at 1GB
+		long nnz = 0;
+		int max_index = -1;
+		bool non_negative = true;
+		for(int i=0;i<l;i++)
+			for(const svm_node *p=x[i];p->index!=-1;p++)
+			{
+				nnz++;
+				max_index = max(max_index,p->index);
+				non_negative = non_negative && p->index >= 0;
+			}
+		int dim = max_index+1;
+		if(l > 0 && dim > 0 && non_negative && dim <= 16*(nnz/l+1) &&
+		   (double)l*dim*sizeof(double) <= (double)(1<<30))
+		{
+			dense_dim = dim;
+			dense = new double[(size_t)l*dim];
+			dense_x = new const double*[l];
+			memset(dense,0,sizeof(double)*(size_t)l*dim);
+			for(int i=0;i<l;i++)
+			{
+				double *row = dense+(size_t)i*dim;
+				for(const svm_node *p=x[i];p->index!=-1;p++)
+					row[p->index] = p->value;
+				dense_x[i] = row;
+			}
+		}
+	}
+
 	if(kernel_type == RBF)
 	{
 		x_square = new double[l];
 		for(int i=0;i<l;i++)
-			x_square[i] = dot(x[i],x[i]);
+			x_square[i] = dot(i,i);
 	}
 	else
 		x_square = 0;
@@ -289,6 +507,8 @@ Kernel::~Kernel()
 {
 	delete[] x;
 	delete[] x_square;
+	delete[] dense;
+	delete[] dense_x;
 }
 
 double Kernel::dot(const svm_node *px, const svm_node *py)
@@ -1279,11 +1499,13 @@ public:
 	Qfloat *get_Q(int i, int len) const
 	{
 		Qfloat *data;
-		int start, j;
+		int start;
 		if((start = cache->get_data(i,&data,len)) < len)
 		{
-			for(j=start;j<len;j++)
-				data[j] = (Qfloat)(y[i]*y[j]*(this->*kernel_function)(i,j));
+			parallel_for(start,len,KERNEL_GRAIN,[&](int b, int e) {
+				for(int j=b;j<e;j++)
+					data[j] = (Qfloat)(y[i]*y[j]*(this->*kernel_function)(i,j));
+			});
 		}
 		return data;
 	}
@@ -1328,11 +1550,13 @@ public:
 	Qfloat *get_Q(int i, int len) const
 	{
 		Qfloat *data;
-		int start, j;
+		int start;
 		if((start = cache->get_data(i,&data,len)) < len)
 		{
-			for(j=start;j<len;j++)
-				data[j] = (Qfloat)(this->*kernel_function)(i,j);
+			parallel_for(start,len,KERNEL_GRAIN,[&](int b, int e) {
+				for(int j=b;j<e;j++)
+					data[j] = (Qfloat)(this->*kernel_function)(i,j);
+			});
 		}
 		return data;
 	}
@@ -1397,8 +1621,10 @@ public:
 		int j, real_i = index[i];
 		if(cache->get_data(real_i,&data,l) < l)
 		{
-			for(j=0;j<l;j++)
-				data[j] = (Qfloat)(this->*kernel_function)(real_i,j);
+			parallel_for(0,l,KERNEL_GRAIN,[&](int b, int e) {
+				for(int k=b;k<e;k++)
+					data[k] = (Qfloat)(this->*kernel_function)(real_i,k);
+			});
 		}
 
 		// reorder and copy
@@ -2412,46 +2638,61 @@ void svm_cross_validation(const svm_problem *prob, const svm_parameter *param, i
 			fold_start[i]=i*l/nr_fold;
 	}
 
-	for(i=0;i<nr_fold;i++)
+	// Folds only read prob and write their own entries of target,
+	// so they train side by side; each holds its own kernel cache.
+	// Probability training shuffles with rand(), so those folds stay
+	// serial and draw the same sequence as upstream libsvm
+	std::atomic<int> next_fold(0);
+	auto train_folds = [&]()
 	{
-		int begin = fold_start[i];
-		int end = fold_start[i+1];
-		int j,k;
-		struct svm_problem subprob;
-
-		subprob.l = l-(end-begin);
-		subprob.x = Malloc(struct svm_node*,subprob.l);
-		subprob.y = Malloc(double,subprob.l);
-			
-		k=0;
-		for(j=0;j<begin;j++)
-		{
-			subprob.x[k] = prob->x[perm[j]];
-			subprob.y[k] = prob->y[perm[j]];
-			++k;
-		}
-		for(j=end;j<l;j++)
-		{
-			subprob.x[k] = prob->x[perm[j]];
-			subprob.y[k] = prob->y[perm[j]];
-			++k;
-		}
-		struct svm_model *submodel = svm_train(&subprob,param);
-		if(param->probability && 
-		   (param->svm_type == C_SVC || param->svm_type == NU_SVC))
+		for(int i;(i = next_fold++) < nr_fold;)
 		{
-			double *prob_estimates=Malloc(double,svm_get_nr_class(submodel));
-			for(j=begin;j<end;j++)
-				target[perm[j]] = svm_predict_probability(submodel,prob->x[perm[j]],prob_estimates);
-			free(prob_estimates);
+			int begin = fold_start[i];
+			int end = fold_start[i+1];
+			int j,k;
+			struct svm_problem subprob;
+
+			subprob.l = l-(end-begin);
+			subprob.x = Malloc(struct svm_node*,subprob.l);
+			subprob.y = Malloc(double,subprob.l);
+
+			k=0;
+			for(j=0;j<begin;j++)
+			{
+				subprob.x[k] = prob->x[perm[j]];
+				subprob.y[k] = prob->y[perm[j]];
+				++k;
+			}
+			for(j=end;j<l;j++)
+			{
+				subprob.x[k] = prob->x[perm[j]];
+				subprob.y[k] = prob->y[perm[j]];
+				++k;
+			}
+			struct svm_model *submodel = svm_train(&subprob,param);
+			if(param->probability &&
+			   (param->svm_type == C_SVC || param->svm_type == NU_SVC))
+			{
+				double *prob_estimates=Malloc(double,svm_get_nr_class(submodel));
+				for(j=begin;j<end;j++)
+					target[perm[j]] = svm_predict_probability(submodel,prob->x[perm[j]],prob_estimates);
+				free(prob_estimates);
+			}
+			else
+				for(j=begin;j<end;j++)
+					target[perm[j]] = svm_predict(submodel,prob->x[perm[j]]);
+			svm_free_and_destroy_model(&submodel);
+			free(subprob.x);
+			free(subprob.y);
 		}
-		else
-			for(j=begin;j<end;j++)
-				target[perm[j]] = svm_predict(submodel,prob->x[perm[j]]);
-		svm_free_and_destroy_model(&submodel);
-		free(subprob.x);
-		free(subprob.y);
-	}		
+	};
+	std::vector<std::thread> fold_threads;
+	int fold_workers = param->probability ? 1 : min(nr_fold,thread_count());
+	for(i=1;i<fold_workers;i++)
+		fold_threads.push_back(std::thread(train_folds));
+	train_folds();
+	for(i=0;i<(int)fold_threads.size();i++)
+		fold_threads[i].join();
 	free(fold_start);
 	free(perm);
 }
@@ -2523,8 +2764,10 @@ double svm_predict_values(const svm_model *model, const svm_node *x, double* dec
 		int l = model->l;
 		
 		double *kvalue = Malloc(double,l);
-		for(i=0;i<l;i++)
-			kvalue[i] = Kernel::k_function(x,model->SV[i],model->param);
+		parallel_for(0,l,KERNEL_GRAIN,[&](int b, int e) {
+			for(int k=b;k<e;k++)
+				kvalue[k] = Kernel::k_function(x,model->SV[k],model->param);
+		});
 
 		int *start = Malloc(int,nr_class);
 		start[0] = 0;
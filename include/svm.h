@@ -97,6 +97,17 @@ int svm_check_probability_model(const struct svm_model *model);
 
 void svm_set_print_string_function(void (*print_func)(const char *));
 
+/* threads for kernel columns and cross validation folds, 0 = one per
+   hardware thread (default); not while training */
+void svm_set_num_threads(int n);
+
+/* runs body(ctx, b, e) over [begin, end) in chunks of at least grain and
+   returns when all are done, in place of the built in pool, so an
+   application can put kernel columns on its own threads; NULL restores
+   the pool; not while training */
+void svm_set_parallel_for(void (*run)(int begin, int end, int grain,
+			  void (*body)(void *ctx, int b, int e), void *ctx));
+
 #ifdef __cplusplus
 }
 #endif
@@ -1,3 +1,5 @@
+import sys
+import struct
 import tensorflow as tf
 
 #load mnist data
@@ -103,6 +105,47 @@ iters = 600000 #10epoch
 
 saver = tf.train.Saver()
 
+#Weights for the native C++ inference engine (src/CNN.cpp)
+#Layout, little endian: "DSCN", uint32 version, uint32 tensor count, then per tensor
+#uint32 name length, name, uint32 rank, int32 dims[rank], float32 data
+def write_tensor(f, name, value):
+  f.write(struct.pack('<I', len(name)))
+  f.write(name.encode('ascii'))
+  f.write(struct.pack('<I', value.ndim))
+  f.write(struct.pack('<%di' % value.ndim, *value.shape))
+  f.write(value.astype('<f4').tobytes())
+
+#Activation range at the input of each layer after conv1, for the int8 path.
+#Calibrated on binarized training digits, like the scanner's inputs.
+def calibrate(sess, n = 1000):
+  sample = (x_train[:n] >= 128).astype('float32').reshape(n, 28, 28, 1)
+  acts = sess.run([mp1, mp2, flat, dense1], feed_dict={image: sample})
+  names = ['quant/conv2_input', 'quant/conv3_input', 'quant/dense1_input', 'quant/dense2_input']
+  return [(name, act.max().reshape(1)) for name, act in zip(names, acts)]
+
+def export_weights(sess, path):
+  names = ['conv1/kernel', 'conv1/bias',
+           'conv2/kernel', 'conv2/bias',
+           'conv3/kernel', 'conv3/bias',
+           'dense1/kernel', 'dense1/bias',
+           'dense2/kernel', 'dense2/bias']
+  graph = tf.get_default_graph()
+  tensors = [(name, sess.run(graph.get_tensor_by_name(name + ':0'))) for name in names]
+  tensors += calibrate(sess)
+  with open(path, 'wb') as f:
+    f.write(b'DSCN')
+    f.write(struct.pack('<II', 1, len(tensors)))
+    for name, value in tensors:
+      write_tensor(f, name, value)
+  print("exported weights to", path)
+
+#python mnist_train.py export: write weights of the latest checkpoint only
+if len(sys.argv) > 1 and sys.argv[1] == 'export':
+  with tf.Session() as sess:
+    saver.restore(sess, tf.train.latest_checkpoint('model'))
+    export_weights(sess, 'model/cnn_weights.bin')
+  sys.exit(0)
+
 with tf.Session() as sess:
    tf.train.write_graph(sess.graph, '.', 'model/graph.pb', as_text=False)
     
@@ -120,4 +163,4 @@ with tf.Session() as sess:
            print("iters: ", i,  " loss: ", train_loss, " accuracy: ", acc[1])
            saver.save(sess, 'model/mnist_', i)
                                                     
-   
+   export_weights(sess, 'model/cnn_weights.bin')
@@ -0,0 +1,96 @@
+//
+//  Admission.cpp
+//  DigitScanner
+//
+
+#include "Admission.hpp"
+
+AdmissionControl::AdmissionControl(const ClassLimits limits[REQUEST_CLASSES]) : next_seq(0), closed(false) {
+
+    for (int c = 0; c < REQUEST_CLASSES; c++) {
+        ClassState& s = classes[c];
+        s.limits = limits[c];
+        if (s.limits.concurrency < 1)
+            s.limits.concurrency = 1;
+        s.in_flight = 0;
+        s.admitted = s.rejected = s.expired = 0;
+    }
+}
+
+AdmissionControl::Result AdmissionControl::enter(RequestClass cls, Clock::time_point deadline) {
+
+    std::unique_lock<std::mutex> guard(lock);
+    ClassState& c = classes[cls];
+    if (!closed && c.in_flight < c.limits.concurrency && c.waiters.empty()) {
+        c.in_flight++;
+        c.admitted++;
+        return ADMITTED;
+    }
+    if (closed || c.waiters.size() >= c.limits.queue) {
+        c.rejected++;
+        return REJECTED;
+    }
+
+    const Waiter self = { deadline, next_seq++ };
+    c.waiters.insert(self);
+    Result result;
+    for (;;) {
+        if (closed) {
+            c.rejected++;
+            result = REJECTED;
+            break;
+        }
+        //Earliest deadline of the class goes first
+        if (c.in_flight < c.limits.concurrency && !(*c.waiters.begin() < self)) {
+            c.in_flight++;
+            c.admitted++;
+            result = ADMITTED;
+            break;
+        }
+        if (Clock::now() >= deadline) {
+            c.expired++;
+            result = EXPIRED;
+            break;
+        }
+        if (deadline == Clock::time_point::max())
+            slot_free.wait(guard);
+        else
+            slot_free.wait_until(guard, deadline);
+    }
+    c.waiters.erase(self);
+    //The next waiter may fit too, or become first in line
+    guard.unlock();
+    slot_free.notify_all();
+    return result;
+}
+
+void AdmissionControl::leave(RequestClass cls) {
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        classes[cls].in_flight--;
+    }
+    slot_free.notify_all();
+}
+
+void AdmissionControl::close() {
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        closed = true;
+    }
+    slot_free.notify_all();
+}
+
+AdmissionControl::ClassStats AdmissionControl::stats(RequestClass cls) const {
+
+    std::lock_guard<std::mutex> guard(lock);
+    const ClassState& c = classes[cls];
+    ClassStats s;
+    s.in_flight = c.in_flight;
+    s.waiting = c.waiters.size();
+    s.admitted = c.admitted;
+    s.rejected = c.rejected;
+    s.expired = c.expired;
+    return s;
+}
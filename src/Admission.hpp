@@ -0,0 +1,98 @@
+//
+//  Admission.hpp
+//  DigitScanner
+//
+//  Admission control for the scan daemon. Requests come in classes,
+//  interactive single pages and bulk reprocessing, each with its own
+//  limit on pages inside the stages at once and on requests waiting
+//  for a slot. Waiters of a class are admitted earliest deadline
+//  first. A waiter whose deadline passes gives up, and a full waiting
+//  line turns requests away at once, so bulk floods cannot build
+//  unbounded queues in front of interactive pages.
+//
+
+#ifndef Admission_hpp
+#define Admission_hpp
+
+#include <stdint.h>
+#include <set>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+//Lower is more urgent, stage queues serve classes in this order
+enum RequestClass {
+    REQUEST_INTERACTIVE,
+    REQUEST_BULK,
+    REQUEST_CLASSES
+};
+
+struct ClassLimits {
+    int concurrency;        //pages admitted at once
+    size_t queue;           //requests waiting for admission
+    int deadline_ms;        //for requests that bring none, 0 for none
+};
+
+class AdmissionControl {
+
+public:
+
+    typedef std::chrono::steady_clock Clock;
+
+    enum Result {
+        ADMITTED,
+        REJECTED,           //waiting line full or shutting down
+        EXPIRED             //deadline passed while waiting
+    };
+
+    struct ClassStats {
+        int in_flight;
+        size_t waiting;
+        long admitted, rejected, expired;
+    };
+
+    explicit AdmissionControl(const ClassLimits limits[REQUEST_CLASSES]);
+
+    /**
+     *  enter():
+     *  Wait for a slot of cls. Every ADMITTED has to be matched by a
+     *  leave().
+     */
+    Result enter(RequestClass cls, Clock::time_point deadline);
+    void leave(RequestClass cls);
+
+    //Turns away waiters and new requests
+    void close();
+
+    ClassStats stats(RequestClass cls) const;
+    const ClassLimits& limits(RequestClass cls) const { return classes[cls].limits; }
+
+private:
+
+    struct Waiter {
+        Clock::time_point deadline;
+        uint64_t seq;
+
+        bool operator<(const Waiter& o) const {
+            return deadline != o.deadline ? deadline < o.deadline : seq < o.seq;
+        }
+    };
+
+    struct ClassState {
+        ClassLimits limits;
+        int in_flight;
+        std::set<Waiter> waiters;
+        long admitted, rejected, expired;
+    };
+
+    mutable std::mutex lock;
+    std::condition_variable slot_free;
+    ClassState classes[REQUEST_CLASSES];
+    uint64_t next_seq;
+    bool closed;
+
+    AdmissionControl(const AdmissionControl&);
+    AdmissionControl& operator=(const AdmissionControl&);
+};
+
+#endif /* Admission_hpp */
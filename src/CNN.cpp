@@ -0,0 +1,631 @@
+//
+//  CNN.cpp
+//  DigitScanner
+//
+
+#include "headers.h"
+#include "CNN.hpp"
+#include "QGemm.hpp"
+
+#include <map>
+#include <chrono>
+#include <limits>
+#include <stdint.h>
+#include <string.h>
+
+//Floats of im2col patches convolve() builds at once
+static const size_t PATCH_BUDGET = 1 << 21;
+
+struct WeightTensor {
+    std::vector<int> dims;
+    std::vector<float> data;
+};
+
+static bool read_weights(const char* path, std::map<std::string, WeightTensor>& tensors) {
+
+    std::ifstream ifs(path, std::ifstream::binary);
+    if (!ifs) {
+        return false;
+    }
+
+    char magic[4];
+    uint32_t version = 0, count = 0;
+    ifs.read(magic, 4);
+    ifs.read((char*)&version, sizeof(version));
+    ifs.read((char*)&count, sizeof(count));
+    if (!ifs || memcmp(magic, "DSCN", 4) != 0 || version != 1) {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t name_len = 0, rank = 0;
+        ifs.read((char*)&name_len, sizeof(name_len));
+        std::string name(name_len, '\0');
+        ifs.read(&name[0], name_len);
+        ifs.read((char*)&rank, sizeof(rank));
+
+        WeightTensor& t = tensors[name];
+        t.dims.resize(rank);
+        size_t size = 1;
+        for (uint32_t d = 0; d < rank; d++) {
+            int32_t dim = 0;
+            ifs.read((char*)&dim, sizeof(dim));
+            t.dims[d] = dim;
+            size *= dim;
+        }
+        t.data.resize(size);
+        ifs.read((char*)t.data.data(), size * sizeof(float));
+        if (!ifs) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool take(std::map<std::string, WeightTensor>& tensors, const std::string& name,
+                 const std::vector<int>& dims, std::vector<float>& out) {
+
+    std::map<std::string, WeightTensor>::iterator it = tensors.find(name);
+    if (it == tensors.end() || it->second.dims != dims) {
+        fprintf(stderr, "ERROR: weight %s missing or of wrong shape\n", name.c_str());
+        return false;
+    }
+    out.swap(it->second.data);
+    return true;
+}
+
+//Same padded patches of a h x w x c map, one row of kh * kw * c
+//values (then zeros up to row_len) per output pixel of rows y_begin..y_end - 1.
+template <typename T>
+static void im2col(const T* in, int h, int w, int c, int kh, int kw, int row_len, T* out,
+                   int y_begin, int y_end) {
+
+    //TF same padding, stride 1: the extra pixel of an even kernel goes after
+    const int pad_t = (kh - 1) / 2;
+    const int pad_l = (kw - 1) / 2;
+    const int k = kh * kw * c;
+
+    for (int y = y_begin; y < y_end; y++) {
+        for (int x = 0; x < w; x++) {
+            T* row = out + ((size_t)(y - y_begin) * w + x) * row_len;
+            //Each kernel row is one contiguous run of the input row, clipped at the borders
+            const int x0 = std::max(x - pad_l, 0);
+            const int x1 = std::min(x - pad_l + kw, w);
+            const int lead = (x0 - (x - pad_l)) * c;
+            const int span = std::max(x1 - x0, 0) * c;
+            for (int i = 0; i < kh; i++) {
+                const int iy = y + i - pad_t;
+                T* dst = row + i * kw * c;
+                if (iy < 0 || iy >= h || span == 0) {
+                    memset(dst, 0, kw * c * sizeof(T));
+                    continue;
+                }
+                const T* src = in + ((size_t)iy * w + x0) * c;
+                if (span == kw * c) {
+                    memcpy(dst, src, span * sizeof(T));
+                    continue;
+                }
+                memset(dst, 0, lead * sizeof(T));
+                memcpy(dst + lead, src, span * sizeof(T));
+                memset(dst + lead + span, 0, (kw * c - lead - span) * sizeof(T));
+            }
+            memset(row + k, 0, (row_len - k) * sizeof(T));
+        }
+    }
+}
+
+//2x2 max pool, same padding. ReLU(max(x) + b) == max(ReLU(x + b)),
+//so bias and ReLU only touch the pooled values.
+static void relu_pool(const float* conv, int h, int w, int c, const float* bias, float* out) {
+
+    const int oh = (h + 1) / 2;
+    const int ow = (w + 1) / 2;
+    for (int oy = 0; oy < oh; oy++) {
+        for (int ox = 0; ox < ow; ox++) {
+            float* dst = out + ((size_t)oy * ow + ox) * c;
+            for (int o = 0; o < c; o++) {
+                dst[o] = -std::numeric_limits<float>::infinity();
+            }
+            for (int dy = 0; dy < 2 && 2 * oy + dy < h; dy++) {
+                for (int dx = 0; dx < 2 && 2 * ox + dx < w; dx++) {
+                    const float* src = conv + ((size_t)(2 * oy + dy) * w + 2 * ox + dx) * c;
+                    for (int o = 0; o < c; o++) {
+                        dst[o] = std::max(dst[o], src[o]);
+                    }
+                }
+            }
+            for (int o = 0; o < c; o++) {
+                dst[o] = std::max(dst[o] + bias[o], 0.f);
+            }
+        }
+    }
+}
+
+//Non negative values to 0-127 steps of scale
+static inline uint8_t quantize_u7(float v, float inv_scale) {
+    const float q = v * inv_scale + 0.5f;
+    return q >= 127.f ? 127 : (q <= 0.f ? 0 : (uint8_t)q);
+}
+
+static void quantize_u7(const float* in, size_t n, float scale, uint8_t* out) {
+    const float inv = 1.f / scale;
+    for (size_t i = 0; i < n; i++) {
+        out[i] = quantize_u7(in[i], inv);
+    }
+}
+
+//relu_pool() on int32 accumulators. The per channel scales are positive,
+//so pooling before dequantizing gives the same result; the output is
+//requantized straight to the input steps of the next layer.
+static void qrelu_pool(const int32_t* acc, int h, int w, int c, const float* scale, const float* bias,
+                       float next_scale, uint8_t* out) {
+
+    const float inv = 1.f / next_scale;
+    const int oh = (h + 1) / 2;
+    const int ow = (w + 1) / 2;
+    std::vector<int32_t> m(c);
+    for (int oy = 0; oy < oh; oy++) {
+        for (int ox = 0; ox < ow; ox++) {
+            std::fill(m.begin(), m.end(), std::numeric_limits<int32_t>::min());
+            for (int dy = 0; dy < 2 && 2 * oy + dy < h; dy++) {
+                for (int dx = 0; dx < 2 && 2 * ox + dx < w; dx++) {
+                    const int32_t* src = acc + ((size_t)(2 * oy + dy) * w + 2 * ox + dx) * c;
+                    for (int o = 0; o < c; o++) {
+                        m[o] = std::max(m[o], src[o]);
+                    }
+                }
+            }
+            uint8_t* dst = out + ((size_t)oy * ow + ox) * c;
+            for (int o = 0; o < c; o++) {
+                dst[o] = quantize_u7(m[o] * scale[o] + bias[o], inv);
+            }
+        }
+    }
+}
+
+//Bit pack a map that is exactly 0 / 1, one row of w bits per (w + 31) / 32 words.
+//Returns false as soon as another value shows up.
+static bool pack_binary(const float* in, int h, int w, uint32_t* bits, int& ink) {
+
+    const int words = (w + 31) / 32;
+    ink = 0;
+    for (int y = 0; y < h; y++) {
+        uint32_t* row = bits + y * words;
+        for (int i = 0; i < words; i++) {
+            row[i] = 0;
+        }
+        for (int x = 0; x < w; x++) {
+            const float v = in[y * w + x];
+            if (v == 1.f) {
+                row[x / 32] |= 1u << (x % 32);
+                ink++;
+            }
+            else if (v != 0.f) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+//Same padded convolution of a bit packed single channel map: every set
+//pixel adds the kernel to the outputs it reaches, zeros are skipped.
+//flipped is the kernel with its columns reversed (kh x kw x out), so the
+//outputs x0..x1 of one kernel row take one contiguous run of it.
+static void binary_conv(const uint32_t* bits, int h, int w, const float* flipped, int kh, int kw, int out, float* acc) {
+
+    const int pad_t = (kh - 1) / 2;
+    const int pad_l = (kw - 1) / 2;
+    const int words = (w + 31) / 32;
+
+    std::fill(acc, acc + (size_t)h * w * out, 0.f);
+
+    for (int sy = 0; sy < h; sy++) {
+        for (int word = 0; word < words; word++) {
+            for (uint32_t set = bits[sy * words + word]; set; set &= set - 1) {
+                const int sx = word * 32 + __builtin_ctz(set);
+
+                //Output (y, x) reads (sy, sx) through tap (sy - y + pad_t, sx - x + pad_l)
+                const int x_first = sx + pad_l - (kw - 1);
+                const int x0 = std::max(x_first, 0);
+                const int x1 = std::min(sx + pad_l + 1, w);
+                const int len = (x1 - x0) * out;
+                for (int i = 0; i < kh; i++) {
+                    const int y = sy - i + pad_t;
+                    if (y < 0 || y >= h) {
+                        continue;
+                    }
+                    float* dst = acc + ((size_t)y * w + x0) * out;
+                    const float* src = flipped + ((size_t)i * kw + (x0 - x_first)) * out;
+                    Eigen::Map<Eigen::ArrayXf>(dst, len) += Eigen::Map<const Eigen::ArrayXf>(src, len);
+                }
+            }
+        }
+    }
+}
+
+//Kernel of a single input channel layer with its columns reversed
+static void flip_columns(const float* kernel, int kh, int kw, int out, std::vector<float>& flipped) {
+
+    flipped.resize((size_t)kh * kw * out);
+    for (int i = 0; i < kh; i++) {
+        for (int j = 0; j < kw; j++) {
+            for (int o = 0; o < out; o++) {
+                flipped[((size_t)i * kw + (kw - 1 - j)) * out + o] = kernel[((size_t)i * kw + j) * out + o];
+            }
+        }
+    }
+}
+
+CNN::CNN() {
+    num_classes = 0;
+    use_int8 = false;
+    conv1.algorithm = conv2.algorithm = conv3.algorithm = CONV_IM2COL;
+    loaded = false;
+    quantized = false;
+}
+
+bool CNN::load(const char* weights_path) {
+
+    std::map<std::string, WeightTensor> tensors;
+    if (!read_weights(weights_path, tensors)) {
+        fprintf(stderr, "ERROR: Unable to read weights %s\n", weights_path);
+        return false;
+    }
+
+    conv1.kh = 14; conv1.kw = 14; conv1.in = 1;  conv1.out = 36;
+    conv2.kh = 7;  conv2.kw = 7;  conv2.in = 36; conv2.out = 36;
+    conv3.kh = 4;  conv3.kw = 4;  conv3.in = 36; conv3.out = 36;
+    dense1.in = 576; dense1.out = 576;
+    dense2.in = 576; dense2.out = 10;
+
+    ConvLayer* convs[] = { &conv1, &conv2, &conv3 };
+    const char* conv_names[] = { "conv1", "conv2", "conv3" };
+    for (int i = 0; i < 3; i++) {
+        ConvLayer& l = *convs[i];
+        std::string name = conv_names[i];
+        if (!take(tensors, name + "/kernel", {l.kh, l.kw, l.in, l.out}, l.kernel) ||
+            !take(tensors, name + "/bias", {l.out}, l.bias)) {
+            return false;
+        }
+    }
+
+    DenseLayer* denses[] = { &dense1, &dense2 };
+    const char* dense_names[] = { "dense1", "dense2" };
+    for (int i = 0; i < 2; i++) {
+        DenseLayer& l = *denses[i];
+        std::string name = dense_names[i];
+        if (!take(tensors, name + "/kernel", {l.in, l.out}, l.kernel) ||
+            !take(tensors, name + "/bias", {l.out}, l.bias)) {
+            return false;
+        }
+    }
+
+    num_classes = dense2.out;
+    loaded = true;
+
+    select_algorithms();
+    flip_columns(conv1.kernel.data(), conv1.kh, conv1.kw, conv1.out, conv1_flipped);
+
+    //Activation ranges from calibration, the input is binary
+    quantized = false;
+    const char* calib_names[] = { "quant/conv2_input", "quant/conv3_input", "quant/dense1_input", "quant/dense2_input" };
+    float input_max[5] = { 1.f };
+    for (int i = 0; i < 4; i++) {
+        std::map<std::string, WeightTensor>::iterator it = tensors.find(calib_names[i]);
+        if (it == tensors.end() || it->second.data.size() != 1 || !(it->second.data[0] > 0)) {
+            return true;
+        }
+        input_max[i + 1] = it->second.data[0];
+    }
+
+    quantize_layer(qconv1, conv1.kernel, conv1.kh * conv1.kw * conv1.in, conv1.out, input_max[0]);
+    quantize_layer(qconv2, conv2.kernel, conv2.kh * conv2.kw * conv2.in, conv2.out, input_max[1]);
+    quantize_layer(qconv3, conv3.kernel, conv3.kh * conv3.kw * conv3.in, conv3.out, input_max[2]);
+    quantize_layer(qdense1, dense1.kernel, dense1.in, dense1.out, input_max[3]);
+    quantize_layer(qdense2, dense2.kernel, dense2.in, dense2.out, input_max[4]);
+    quantized = true;
+
+    return true;
+}
+
+void CNN::quantize_layer(QuantLayer& q, const std::vector<float>& kernel, int k, int out, float input_max) {
+
+    q.k = k;
+    q.k_pad = qgemm_pad(k);
+    q.out = out;
+    q.input_scale = input_max / 127.f;
+    q.scale.resize(out);
+
+    //Symmetric per output channel, kernel is k x out
+    std::vector<int8_t> rows((size_t)out * q.k_pad, 0);
+    for (int o = 0; o < out; o++) {
+        float m = 0;
+        for (int i = 0; i < k; i++) {
+            m = std::max(m, std::abs(kernel[(size_t)i * out + o]));
+        }
+        const float step = m > 0 ? m / 127.f : 1.f;
+        for (int i = 0; i < k; i++) {
+            float v = std::round(kernel[(size_t)i * out + o] / step);
+            rows[(size_t)o * q.k_pad + i] = (int8_t)std::max(-127.f, std::min(127.f, v));
+        }
+        q.scale[o] = step * q.input_scale;
+    }
+
+    q.weight.resize(qgemm_packed_size(out, q.k_pad));
+    qgemm_pack(rows.data(), out, q.k_pad, q.weight.data());
+}
+
+void CNN::convolve(ConvLayer& l, const float* in, int h, int w) {
+
+    conv_out.resize((size_t)h * w * l.out);
+
+    if (l.algorithm == CONV_FFT && l.fft.planned_for(h, w)) {
+        l.fft.run(in, conv_out.data());
+        return;
+    }
+
+    const int k = l.kh * l.kw * l.in;
+
+    //Bands of output rows, so page sized maps do not blow up the
+    //patch buffer. Digit sized maps always fit in one band.
+    const int band = std::max(1, (int)(PATCH_BUDGET / ((size_t)w * k)));
+    for (int y = 0; y < h; y += band) {
+        const int rows = std::min(band, h - y);
+        patches.resize((size_t)rows * w * k);
+        im2col(in, h, w, l.in, l.kh, l.kw, k, patches.data(), y, y + rows);
+
+        MapMatrixf(&conv_out[(size_t)y * w * l.out], rows * w, l.out).noalias() =
+            ConstMapMatrixf(patches.data(), rows * w, k) * ConstMapMatrixf(l.kernel.data(), k, l.out);
+    }
+}
+
+void CNN::conv_relu_pool(ConvLayer& l, const float* in, int h, int w, float* out) {
+
+    convolve(l, in, h, w);
+    relu_pool(conv_out.data(), h, w, l.out, l.bias.data(), out);
+}
+
+void CNN::select_algorithms() {
+
+    ConvLayer* convs[] = { &conv1, &conv2, &conv3 };
+    const int sizes[] = { 28, 14, 7 };
+    std::vector<float> in;
+
+    for (int i = 0; i < 3; i++) {
+        ConvLayer& l = *convs[i];
+        const int s = sizes[i];
+        l.fft.init(l.kernel.data(), l.kh, l.kw, l.in, l.out, s, s);
+        in.assign((size_t)s * s * l.in, 0.5f);
+
+        //Best of a few runs, the first one pays for allocations
+        double best[2];
+        const ConvAlgorithm algorithms[] = { CONV_IM2COL, CONV_FFT };
+        for (int a = 0; a < 2; a++) {
+            l.algorithm = algorithms[a];
+            best[a] = std::numeric_limits<double>::max();
+            for (int r = 0; r < 4; r++) {
+                std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                convolve(l, in.data(), s, s);
+                std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+                best[a] = std::min(best[a], elapsed.count());
+            }
+        }
+        l.algorithm = best[1] < best[0] ? CONV_FFT : CONV_IM2COL;
+    }
+}
+
+std::string CNN::conv_algorithms() const {
+
+    const ConvLayer* convs[] = { &conv1, &conv2, &conv3 };
+    std::string names;
+    for (int i = 0; i < 3; i++) {
+        names += (i ? ", conv" : "conv") + std::to_string(i + 1);
+        names += convs[i]->algorithm == CONV_FFT ? " fft" : " im2col";
+    }
+    return names;
+}
+
+void CNN::qconv_relu_pool(const QuantLayer& q, const ConvLayer& l, const uint8_t* in, int h, int w,
+                          float next_scale, uint8_t* out) {
+
+    patches_q.resize((size_t)h * w * q.k_pad);
+    im2col(in, h, w, l.in, l.kh, l.kw, q.k_pad, patches_q.data(), 0, h);
+
+    acc.resize((size_t)h * w * q.out);
+    qgemm_u7s8(patches_q.data(), q.weight.data(), h * w, q.out, q.k_pad, acc.data());
+
+    qrelu_pool(acc.data(), h, w, q.out, q.scale.data(), l.bias.data(), next_scale, out);
+}
+
+void CNN::dense(const DenseLayer& l, const float* in, int batch, bool relu, float* out) {
+
+    MapMatrixf o(out, batch, l.out);
+    o.noalias() = ConstMapMatrixf(in, batch, l.in) * ConstMapMatrixf(l.kernel.data(), l.in, l.out);
+    o.rowwise() += Eigen::Map<const Eigen::RowVectorXf>(l.bias.data(), l.out);
+    if (relu) {
+        o = o.cwiseMax(0.f);
+    }
+}
+
+bool CNN::binary_input(const float* image) {
+
+    //Scattering set pixels stops paying off once half of them are ink
+    input_bits.resize(28);
+    int ink = 0;
+    return pack_binary(image, 28, 28, input_bits.data(), ink) && ink * 2 < 28 * 28;
+}
+
+std::vector<int> CNN::predict(const float* input, int batch) {
+
+    if (!loaded) {
+        fprintf(stderr, "ERROR: CNN weights are not loaded.\n");
+        return std::vector<int>(batch, -1);
+    }
+
+    if (use_int8 && quantized) {
+        return predict_int8(input, batch);
+    }
+
+    const int flat_len = 4 * 4 * conv3.out;
+    pool1.resize(14 * 14 * conv1.out);
+    pool2.resize(7 * 7 * conv2.out);
+    flat.resize((size_t)batch * flat_len);
+
+    //Convolutions one image at a time keeps the im2col buffer small
+    for (int n = 0; n < batch; n++) {
+        const float* image = input + (size_t)n * 28 * 28;
+        if (binary_input(image)) {
+            conv_out.resize(28 * 28 * conv1.out);
+            binary_conv(input_bits.data(), 28, 28, conv1_flipped.data(), conv1.kh, conv1.kw, conv1.out, conv_out.data());
+            relu_pool(conv_out.data(), 28, 28, conv1.out, conv1.bias.data(), pool1.data());
+        }
+        else {
+            conv_relu_pool(conv1, image, 28, 28, pool1.data());
+        }
+        conv_relu_pool(conv2, pool1.data(), 14, 14, pool2.data());
+        conv_relu_pool(conv3, pool2.data(), 7, 7, &flat[(size_t)n * flat_len]);
+    }
+
+    //Dense layers for the whole batch, dropout is identity at inference
+    hidden.resize((size_t)batch * dense1.out);
+    logits.resize((size_t)batch * dense2.out);
+    dense(dense1, flat.data(), batch, true, hidden.data());
+    dense(dense2, hidden.data(), batch, false, logits.data());
+
+    std::vector<int> predictions(batch);
+    for (int b = 0; b < batch; b++) {
+        const float* row = &logits[(size_t)b * num_classes];
+        float m = row[0];
+        int mi = 0;
+        for (int i = 0; i < num_classes; i++) {
+            if (row[i] > m) {
+                mi = i;
+                m = row[i];
+            }
+        }
+        predictions[b] = mi;
+    }
+
+    return predictions;
+}
+
+std::vector<int> CNN::predict_int8(const float* input, int batch) {
+
+    const int flat_len = 4 * 4 * conv3.out;
+    act0.resize(28 * 28);
+    act1.resize(14 * 14 * conv1.out);
+    act2.resize(7 * 7 * conv2.out);
+    flat_q.resize((size_t)batch * qdense1.k_pad);
+
+    //Each pooled map is requantized with the input range of the next layer
+    for (int n = 0; n < batch; n++) {
+        uint8_t* row = &flat_q[(size_t)n * qdense1.k_pad];
+        quantize_u7(input + (size_t)n * 28 * 28, 28 * 28, qconv1.input_scale, act0.data());
+        qconv_relu_pool(qconv1, conv1, act0.data(), 28, 28, qconv2.input_scale, act1.data());
+        qconv_relu_pool(qconv2, conv2, act1.data(), 14, 14, qconv3.input_scale, act2.data());
+        qconv_relu_pool(qconv3, conv3, act2.data(), 7, 7, qdense1.input_scale, row);
+        memset(row + flat_len, 0, qdense1.k_pad - flat_len);
+    }
+
+    //dense1, ReLU, requantize
+    acc.resize((size_t)batch * qdense1.out);
+    qgemm_u7s8(flat_q.data(), qdense1.weight.data(), batch, qdense1.out, qdense1.k_pad, acc.data());
+    hidden.resize(qdense1.out);
+    hidden_q.resize((size_t)batch * qdense2.k_pad);
+    for (int b = 0; b < batch; b++) {
+        for (int o = 0; o < qdense1.out; o++) {
+            hidden[o] = std::max(acc[(size_t)b * qdense1.out + o] * qdense1.scale[o] + dense1.bias[o], 0.f);
+        }
+        uint8_t* row = &hidden_q[(size_t)b * qdense2.k_pad];
+        quantize_u7(hidden.data(), qdense1.out, qdense2.input_scale, row);
+        memset(row + qdense1.out, 0, qdense2.k_pad - qdense1.out);
+    }
+
+    //dense2 logits
+    acc.resize((size_t)batch * qdense2.out);
+    qgemm_u7s8(hidden_q.data(), qdense2.weight.data(), batch, qdense2.out, qdense2.k_pad, acc.data());
+    logits.resize((size_t)batch * num_classes);
+    for (int b = 0; b < batch; b++) {
+        for (int o = 0; o < num_classes; o++) {
+            logits[(size_t)b * num_classes + o] = acc[(size_t)b * num_classes + o] * qdense2.scale[o] + dense2.bias[o];
+        }
+    }
+
+    std::vector<int> predictions(batch);
+    for (int b = 0; b < batch; b++) {
+        const float* row = &logits[(size_t)b * num_classes];
+        predictions[b] = (int)(std::max_element(row, row + num_classes) - row);
+    }
+
+    return predictions;
+}
+
+std::vector<int> CNN::predict_regions(const float* map, int h, int w,
+                                      const std::vector<std::pair<float, float> >& centers) {
+
+    const int n = (int)centers.size();
+    if (!loaded) {
+        fprintf(stderr, "ERROR: CNN weights are not loaded.\n");
+        return std::vector<int>(n, -1);
+    }
+
+    const int h1 = (h + 1) / 2, w1 = (w + 1) / 2;
+    const int h2 = (h1 + 1) / 2, w2 = (w1 + 1) / 2;
+    const int h3 = (h2 + 1) / 2, w3 = (w2 + 1) / 2;
+
+    //Conv stack once over the whole map
+    pool1.resize((size_t)h1 * w1 * conv1.out);
+    pool2.resize((size_t)h2 * w2 * conv2.out);
+    features.resize((size_t)h3 * w3 * conv3.out);
+
+    int ink = 0;
+    input_bits.resize((size_t)h * ((w + 31) / 32));
+    if (pack_binary(map, h, w, input_bits.data(), ink) && ink * 2 < h * w) {
+        conv_out.resize((size_t)h * w * conv1.out);
+        binary_conv(input_bits.data(), h, w, conv1_flipped.data(), conv1.kh, conv1.kw, conv1.out, conv_out.data());
+        relu_pool(conv_out.data(), h, w, conv1.out, conv1.bias.data(), pool1.data());
+    }
+    else {
+        conv_relu_pool(conv1, map, h, w, pool1.data());
+    }
+    conv_relu_pool(conv2, pool1.data(), h1, w1, pool2.data());
+    conv_relu_pool(conv3, pool2.data(), h2, w2, features.data());
+
+    //A 28x28 window covers 4x4 cells of 8 pixels, centered on the region
+    const int cells = 4;
+    const int flat_len = cells * cells * conv3.out;
+    flat.assign((size_t)n * flat_len, 0.f);
+    for (int b = 0; b < n; b++) {
+        const int top = (int)std::lround(centers[b].second / 8.f - cells / 2);
+        const int left = (int)std::lround(centers[b].first / 8.f - cells / 2);
+        for (int i = 0; i < cells; i++) {
+            const int fy = top + i;
+            if (fy < 0 || fy >= h3) {
+                continue;
+            }
+            for (int j = 0; j < cells; j++) {
+                const int fx = left + j;
+                if (fx < 0 || fx >= w3) {
+                    continue;
+                }
+                memcpy(&flat[(size_t)b * flat_len + (i * cells + j) * conv3.out],
+                       &features[((size_t)fy * w3 + fx) * conv3.out], conv3.out * sizeof(float));
+            }
+        }
+    }
+
+    hidden.resize((size_t)n * dense1.out);
+    logits.resize((size_t)n * dense2.out);
+    dense(dense1, flat.data(), n, true, hidden.data());
+    dense(dense2, hidden.data(), n, false, logits.data());
+
+    std::vector<int> predictions(n);
+    for (int b = 0; b < n; b++) {
+        const float* row = &logits[(size_t)b * num_classes];
+        predictions[b] = (int)(std::max_element(row, row + num_classes) - row);
+    }
+
+    return predictions;
+}
@@ -0,0 +1,159 @@
+//
+//  CNN.hpp
+//  DigitScanner
+//
+//  Native inference for the digit network of model/mnist_train.py,
+//  so the CNN classifier can run without libtensorflow.
+//
+//  input 28x28x1
+//  conv1 14x14x36 same, relu, maxpool 2x2 same -> 14x14x36
+//  conv2 7x7x36 same, relu, maxpool 2x2 same   -> 7x7x36
+//  conv3 4x4x36 same, relu, maxpool 2x2 same   -> 4x4x36
+//  dense1 576, relu
+//  dense2 10 (logits, same as dense2/BiasAdd)
+//
+
+#ifndef CNN_hpp
+#define CNN_hpp
+
+#include <vector>
+#include <string>
+#include <utility>
+#include <stdint.h>
+
+#include "FFTConv.hpp"
+
+class CNN {
+
+public:
+
+    CNN();
+
+    /**
+     *  load():
+     *  Read weights written by `python model/mnist_train.py export`.
+     *  File layout, little endian:
+     *  "DSCN", uint32 version, uint32 tensor count, then per tensor
+     *  uint32 name length, name, uint32 rank, int32 dims[rank],
+     *  float32 data in TF order (conv HWIO, dense IO).
+     *  Optional quant/<layer>_input scalars hold the calibrated
+     *  activation range and enable the int8 path.
+     *  @return
+     *  false if the file is missing or does not match the network
+     */
+    bool load(const char* weights_path);
+
+    /**
+     *  predict():
+     *  Classify a batch of NHWC 28x28x1 images.
+     *  @param
+     *  input: batch * 784 floats
+     *  batch: number of images
+     *  @return
+     *  argmax of each row of logits
+     */
+    std::vector<int> predict(const float* input, int batch);
+
+    /**
+     *  predict_regions():
+     *  Fully convolutional variant for a whole text line or page:
+     *  the conv layers run once over the map and each region reads
+     *  the 4x4 cells of conv3 features a 28x28 crop centered on it
+     *  would cover. Float path only; neighbours of a region take the
+     *  place of the zero padding of a crop, so results can differ
+     *  from predict() near other ink.
+     *  @param
+     *  map: h x w, 0 / 1, digits scaled to about 28 pixels
+     *  centers: (x, y) of each region in map pixels
+     *  @return
+     *  argmax of each row of logits
+     */
+    std::vector<int> predict_regions(const float* map, int h, int w,
+                                     const std::vector<std::pair<float, float> >& centers);
+
+    //Output of the last predict(), batch x num_classes, row major
+    std::vector<float> logits;
+
+    int num_classes;
+
+    //Run predict() with int8 weights (per output channel scales),
+    //7 bit activations and int32 accumulation. Needs has_int8().
+    bool use_int8;
+
+    bool has_int8() const { return quantized; }
+
+    //Convolution algorithm picked for each float layer, e.g. "conv1 fft, ..."
+    std::string conv_algorithms() const;
+
+private:
+
+    enum ConvAlgorithm { CONV_IM2COL, CONV_FFT };
+
+    struct ConvLayer {
+        int kh, kw, in, out;
+        std::vector<float> kernel;  //kh x kw x in x out
+        std::vector<float> bias;
+        ConvAlgorithm algorithm;
+        FFTConv fft;                //planned for the layer's map size
+    };
+
+    struct DenseLayer {
+        int in, out;
+        std::vector<float> kernel;  //in x out
+        std::vector<float> bias;
+    };
+
+    //Layer weights quantized for qgemm_u7s8
+    struct QuantLayer {
+        int k, k_pad, out;
+        std::vector<int8_t> weight;     //packed by qgemm_pack()
+        std::vector<float> scale;       //input step * weight step, per output channel
+        float input_scale;              //real value of one input step
+    };
+
+    ConvLayer conv1, conv2, conv3;
+    DenseLayer dense1, dense2;
+
+    QuantLayer qconv1, qconv2, qconv3, qdense1, qdense2;
+
+    bool loaded;
+    bool quantized;
+
+    //conv1 kernel with reversed columns, for the set pixel scatter
+    //of binary digits
+    std::vector<float> conv1_flipped;
+
+    //Scratch reused across calls, so predict() is not reentrant
+    std::vector<float> patches, conv_out, pool1, pool2, features, flat, hidden;
+    std::vector<uint8_t> patches_q, act0, act1, act2, flat_q, hidden_q;
+    std::vector<int32_t> acc;
+    std::vector<uint32_t> input_bits;
+
+    //Same padded convolution into conv_out, by im2col + GEMM or, at the
+    //size it was planned for, FFT
+    void convolve(ConvLayer& l, const float* in, int h, int w);
+
+    //convolve(), then 2x2 same max pooling with bias and ReLU
+    //applied to the pooled values.
+    void conv_relu_pool(ConvLayer& l, const float* in, int h, int w, float* out);
+
+    //Time both algorithms on each layer once and keep the faster
+    void select_algorithms();
+
+    void dense(const DenseLayer& l, const float* in, int batch, bool relu, float* out);
+
+    void quantize_layer(QuantLayer& q, const std::vector<float>& kernel, int k, int out, float input_max);
+
+    //conv_relu_pool() on 7 bit input, pooled output requantized
+    //to 7 bit steps of next_scale
+    void qconv_relu_pool(const QuantLayer& q, const ConvLayer& l, const uint8_t* in, int h, int w,
+                         float next_scale, uint8_t* out);
+
+    //Bit pack a 28x28 input into input_bits if it is 0 / 1 and sparse
+    //enough for the set pixel scatter of conv1
+    bool binary_input(const float* image);
+
+    std::vector<int> predict_int8(const float* input, int batch);
+};
+
+#endif /* CNN_hpp */
@@ -6,17 +6,27 @@
 //  Copyright © 2019 王 颖豪. All rights reserved.
 //
 
+#ifndef DIGITSCANNER_NO_TENSORFLOW
+
 #include "C_TF.hpp"
+#include "Scheduler.hpp"
 
 void free_buffer(void* data, size_t length) { free(data); }
 
 void deallocator(void* ptr, size_t len, void* arg) { free((void*)ptr); }
 
 Model::Model() {
+    sess = nullptr;
+    graph = nullptr;
+    num_classes = 0;
     status = TF_NewStatus();
 }
 
 Model::~Model() {
+    for (auto& t : tensor_pool) {
+        TF_DeleteTensor(t.second);
+    }
+    
     if (sess) {
         TF_DeleteSession(sess, status);
     }
@@ -28,48 +38,93 @@ Model::~Model() {
     TF_DeleteStatus(status);
 }
 
-void Model::load_graph(const char *graph_path) {
+bool Model::load_graph(const char *graph_path) {
+    
+    //A reload starts from an empty graph, the cached ops belong to the old one
+    if (sess) {
+        TF_DeleteSession(sess, status);
+        sess = nullptr;
+    }
+    if (graph) {
+        TF_DeleteGraph(graph);
+        graph = nullptr;
+    }
+    ops.clear();
     
     TF_Buffer* graph_def = read_file(graph_path);
+    if (graph_def == nullptr) {
+        fprintf(stderr, "ERROR: Unable to read graph %s\n", graph_path);
+        return false;
+    }
+    
     graph = TF_NewGraph();
     TF_ImportGraphDefOptions* opts = TF_NewImportGraphDefOptions();
     TF_GraphImportGraphDef(graph, graph_def, opts, status);
+    TF_DeleteBuffer(graph_def);
+    TF_DeleteImportGraphDefOptions(opts);
     
     if (TF_GetCode(status) != TF_OK) {
         fprintf(stderr, "ERROR: Unable to import graph %s\n", TF_Message(status));
-        return;
+        TF_DeleteGraph(graph);
+        graph = nullptr;
+        return false;
     }
     
-    TF_DeleteBuffer(graph_def);
-    TF_DeleteImportGraphDefOptions(opts);
+    return true;
 }
 
-void Model::create_session() {
+bool Model::create_session() {
     
     if (graph == nullptr) {
         fprintf(stderr, "ERROR: graph is undefined.\n");
-        return;
+        return false;
     }
     
     TF_SessionOptions* opt = TF_NewSessionOptions();
+    
+    //ConfigProto with intra_op_parallelism_threads (field 2) at the
+    //thread budget and inter_op_parallelism_threads (field 5) at 1, the
+    //graph is a single chain. Serialized by hand, no protobuf needed.
+    const unsigned fields[2][2] = { { 2, (unsigned)thread_budget() }, { 5, 1 } };
+    unsigned char config[16];
+    size_t config_len = 0;
+    for (auto& f : fields) {
+        config[config_len++] = (unsigned char)(f[0] << 3);
+        for (unsigned v = f[1]; ; v >>= 7) {
+            config[config_len++] = (v & 0x7f) | (v > 0x7f ? 0x80 : 0);
+            if (v <= 0x7f) break;
+        }
+    }
+    TF_SetConfig(opt, config, config_len, status);
+    if (TF_GetCode(status) != TF_OK) {
+        fprintf(stderr, "ERROR: Unable to set session threads %s\n", TF_Message(status));
+    }
+    
     sess = TF_NewSession(graph, opt, status);
+    TF_DeleteSessionOptions(opt);
     
     if (TF_GetCode(status) != TF_OK) {
         fprintf(stderr, "ERROR: Unable to create session %s\n", TF_Message(status));
-        exit(255);
+        sess = nullptr;
+        return false;
     }
     
-    TF_DeleteSessionOptions(opt);
+    return true;
 }
 
-void Model::restore_weights(const char *ckpt_prefix) {
+bool Model::restore_weights(const char *ckpt_prefix) {
     
-    if (graph == nullptr) {
+    if (graph == nullptr || sess == nullptr) {
         fprintf(stderr, "ERROR: graph is undefined.\n");
+        return false;
     }
     
     TF_Operation* checkpoint_op = TF_GraphOperationByName(graph, "save/Const");
     TF_Operation* restore_op = TF_GraphOperationByName(graph, "save/restore_all");
+    if (checkpoint_op == nullptr || restore_op == nullptr) {
+        fprintf(stderr, "ERROR: graph has no save/restore_all op.\n");
+        return false;
+    }
     
     size_t checkpoint_path_str_len = strlen(ckpt_prefix);
     size_t encoded_size = TF_StringEncodedSize(checkpoint_path_str_len);
@@ -83,9 +138,10 @@ void Model::restore_weights(const char *ckpt_prefix) {
     TF_StringEncode(ckpt_prefix, checkpoint_path_str_len,
                     input_encoded + sizeof(int64_t), encoded_size, status);
     if (TF_GetCode(status) != TF_OK) {
-        fprintf(stderr, "ERROR: something wrong with encoding: %s",
+        fprintf(stderr, "ERROR: something wrong with encoding: %s\n",
                 TF_Message(status));
-        return;
+        free(input_encoded);
+        return false;
     }
     
     TF_Tensor* path_tensor = TF_NewTensor(TF_STRING, NULL, 0, input_encoded,
@@ -105,58 +161,100 @@ void Model::restore_weights(const char *ckpt_prefix) {
                   /* Target operations */ &restore_op, 1,
                   /* RunMetadata */ NULL,
                   /* Output status */ status);
+    TF_DeleteTensor(path_tensor);
+    free(run_path);
+    free(run_path_tensors);
+    
     if (TF_GetCode(status) != TF_OK) {
         fprintf(stderr, "ERROR: Unable to run restore_op: %s\n",
                 TF_Message(status));
-        exit(255);
+        return false;
     }
+    
+    return true;
 }
 
-void Model::create_input(const char* input_layer_name, std::vector<float> data, std::vector<int64_t> dims) {
-    TF_Operation* input_op = TF_GraphOperationByName(graph, input_layer_name);
+TF_Operation* Model::operation(const char* name) {
+    
+    std::map<std::string, TF_Operation*>::iterator it = ops.find(name);
+    if (it != ops.end()) {
+        return it->second;
+    }
+    
+    TF_Operation* op = TF_GraphOperationByName(graph, name);
+    if (op != nullptr) {
+        ops[name] = op;
+    }
+    return op;
+}
+
+float* Model::input_buffer(const char* input_layer_name, std::vector<int64_t> dims) {
+    TF_Operation* input_op = operation(input_layer_name);
     if (input_op == nullptr) {
         fprintf(stderr, "Failed to retrieve input op.\n");
-        exit(255);
+        return NULL;
     }
     inputs = {{input_op, 0}};
     
-    TF_Tensor* input_val = TF_AllocateTensor(TF_FLOAT, &dims[0], (int)dims.size(), data.size() * sizeof(float));
-    memcpy(TF_TensorData(input_val), &data[0], data.size() * sizeof(float));
+    TF_Tensor*& input_val = tensor_pool[dims];
+    if (input_val == nullptr) {
+        size_t size = 1;
+        for (int64_t d : dims) size *= d;
+        input_val = TF_AllocateTensor(TF_FLOAT, &dims[0], (int)dims.size(), size * sizeof(float));
+        if (input_val == nullptr) {
+            fprintf(stderr, "Failed to allocate input tensor.\n");
+            tensor_pool.erase(dims);
+            return NULL;
+        }
+    }
+    
+    input_tensors = {input_val};
     
-    input_tensors.push_back(input_val);
+    return (float*)TF_TensorData(input_val);
 }
 
-void Model::create_output(const char *output_layer_name
-                          , std::vector<float> data
-                          , std::vector<int64_t> dims) {
-    TF_Operation* output_op = TF_GraphOperationByName(graph, output_layer_name);
+bool Model::create_input(const char* input_layer_name, const std::vector<float>& data, std::vector<int64_t> dims) {
+    float* input_data = input_buffer(input_layer_name, dims);
+    if (input_data == NULL)
+        return false;
+    memcpy(input_data, &data[0], data.size() * sizeof(float));
+    return true;
+}
+
+bool Model::create_output(const char *output_layer_name) {
+    TF_Operation* output_op = operation(output_layer_name);
     if (output_op == nullptr) {
-        fprintf(stderr, "Failed to retrieve input op.\n");
-        return;
+        fprintf(stderr, "Failed to retrieve output op.\n");
+        return false;
     }
     outputs = {{output_op, 0}};
     
-    TF_Tensor* output_val = TF_AllocateTensor(TF_FLOAT, &dims[0], (int)dims.size(), data.size() * sizeof(float));
-    memcpy(TF_TensorData(output_val), &data[0], data.size() * sizeof(float));
-    
-    output_tensors.push_back(output_val);
+    //Filled in by TF_SessionRun
+    output_tensors = {nullptr};
+    return true;
 }
 
 void Model::clear_input() {
+    //Tensors stay in the pool
     inputs.clear();
     input_tensors.clear();
 }
 
-int Model::predict() {
+std::vector<int> Model::predict() {
+    
+    logits.clear();
     
-    if (inputs.size() != input_tensors.size()) {
+    if (inputs.size() != input_tensors.size() || input_tensors.empty()) {
         fprintf(stderr, "Mismatched input\n");
-        return -1;
+        return std::vector<int>();
     }
     
+    //Batch size is the leading input dimension
+    int64_t batch = TF_Dim(input_tensors[0], 0);
+    
     if (outputs.size() != output_tensors.size()) {
         fprintf(stderr, "Mismatched output\n");
-        return -1;
+        return std::vector<int>(batch, -1);
     }
     
     //Run network
@@ -170,31 +268,56 @@ int Model::predict() {
     
     if (TF_GetCode(status) != TF_OK) {
         fprintf(stderr, "ERROR: Unable to run output_op: %s\n", TF_Message(status));
-        return -1;
+        for (TF_Tensor*& t : output_tensors) {
+            if (t) TF_DeleteTensor(t);
+            t = nullptr;
+        }
+        return std::vector<int>(batch, -1);
     }
     
     //Retreive Predictions
-    float* output_data = (float*)TF_TensorData(output_tensors[0]);
-    float m = output_data[0];
-    int mi = 0;
-    for (int i = 0; i < 10; i++) {
-        if (output_data[i] > m) {
-            mi = i;
-            m = output_data[i];
+    TF_Tensor* output = output_tensors[0];
+    num_classes = TF_NumDims(output) > 1 ? (int)TF_Dim(output, 1) : (int)TF_Dim(output, 0);
+    float* output_data = (float*)TF_TensorData(output);
+    logits.assign(output_data, output_data + batch * num_classes);
+    
+    //Session allocated the outputs, release them for the next run
+    for (TF_Tensor*& t : output_tensors) {
+        TF_DeleteTensor(t);
+        t = nullptr;
+    }
+    
+    std::vector<int> predictions(batch);
+    for (int64_t b = 0; b < batch; b++) {
+        const float* row = &logits[b * num_classes];
+        float m = row[0];
+        int mi = 0;
+        for (int i = 0; i < num_classes; i++) {
+            if (row[i] > m) {
+                mi = i;
+                m = row[i];
+            }
         }
+        predictions[b] = mi;
     }
     
-    return mi;
+    return predictions;
 }
 
 TF_Buffer* Model::read_file(const char* file) {
     FILE* f = fopen(file, "rb");
+    if (f == NULL)
+        return nullptr;
     fseek(f, 0, SEEK_END);
     long fsize = ftell(f);
     fseek(f, 0, SEEK_SET);  // same as rewind(f);
     
-    void* data = malloc(fsize);
-    fread(data, fsize, 1, f);
+    void* data = fsize > 0 ? malloc(fsize) : NULL;
+    if (data == NULL || fread(data, fsize, 1, f) != 1) {
+        free(data);
+        fclose(f);
+        return nullptr;
+    }
     fclose(f);
     
     TF_Buffer* buf = TF_NewBuffer();
@@ -203,3 +326,5 @@ TF_Buffer* Model::read_file(const char* file) {
     buf->data_deallocator = free_buffer;
     return buf;
 }
+
+#endif /* DIGITSCANNER_NO_TENSORFLOW */
@@ -14,6 +14,7 @@
 #include <string.h>
 #include <string>
 #include <vector>
+#include <map>
 #include <tensorflow/c/c_api.h>
 
 class Model {
@@ -28,25 +29,47 @@ public:
     
     TF_Graph* graph;
     
-    void load_graph(const char* graph_path);
+    //Each returns false and prints why if the step failed
+    bool load_graph(const char* graph_path);
     
-    void create_session();
+    bool create_session();
     
-    void restore_weights(const char* ckpt_prefix);
+    bool restore_weights(const char* ckpt_prefix);
     
-    void create_input(const char* input_layer_name, std::vector<float> data, std::vector<int64_t> dims);
+    //Writable memory of the input tensor of shape dims, to be filled
+    //before predict(). Tensors are pooled by shape and reused.
+    //NULL if the graph has no such input.
+    float* input_buffer(const char* input_layer_name, std::vector<int64_t> dims);
     
-    void create_output(const char* output_layer_name, std::vector<float> data, std::vector<int64_t> dims);
+    //Copy data into input_buffer()
+    bool create_input(const char* input_layer_name, const std::vector<float>& data, std::vector<int64_t> dims);
+    
+    //Output op to fetch, {batch, classes} for a classifier
+    bool create_output(const char* output_layer_name);
     
     void clear_input();
     
-    int predict();
+    //Run the batch, return the argmax of each row of the output
+    //and keep the raw output rows in logits.
+    std::vector<int> predict();
+    
+    //Output of the last predict(), batch x num_classes, row major
+    std::vector<float> logits;
+    
+    int num_classes;
     
 private:
     TF_Status* status;
     
     TF_Buffer* read_file(const char* file);
     
+    //Graph lookup, cached by name
+    TF_Operation* operation(const char* name);
+    
+    std::map<std::string, TF_Operation*> ops;
+    
+    std::map<std::vector<int64_t>, TF_Tensor*> tensor_pool;
+    
     std::vector<TF_Output> inputs, outputs;
     
     std::vector<TF_Tensor*> input_tensors, output_tensors;
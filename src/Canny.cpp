@@ -9,6 +9,9 @@
 
 #include "headers.h"
 #include "Canny.h"
+#include "Scheduler.hpp"
+
+#include <algorithm>
 
 typedef unsigned char uchar;
 
@@ -53,29 +56,45 @@ CImg<unsigned char> Canny::process(int gfs = 3, double g_sig = 1, int thres_lo =
 void Canny::toGrayScale()
 {
     grayscaled.assign(img._width, img._height); //To one channel
-    cimg_forXY(img, x, y) {
-        
-        int r = img(x,y,0);
-        int g = img(x,y,1);
-        int b = img(x,y,2);
-        double newValue = (r * 0.2126 + g * 0.7152 + b * 0.0722);
-
-        grayscaled(x,y) = (unsigned char)(newValue);
-    }
+    parallel_for(0, img._height, 16, [&](int y0, int y1) {
+        for (int y = y0; y < y1; y++) {
+            for (int x = 0; x < img._width; x++) {
+                
+                int r = img(x,y,0);
+                int g = img(x,y,1);
+                int b = img(x,y,2);
+                double newValue = (r * 0.2126 + g * 0.7152 + b * 0.0722);
+                
+                grayscaled(x,y) = (unsigned char)(newValue);
+            }
+        }
+    });
 
 }
 
 void Canny::useMedianFilter() {
 
     medianFiltered.assign(grayscaled);
-    CImg<> N(5,5);
-    cimg_forC(grayscaled, c) {
-        cimg_for5x5(grayscaled, x, y, 0, c, N, uchar) {
-            // printf("%d, %d\n", x, y);
-            medianFiltered(x, y, c) = N.median();
-
+    const int w = grayscaled._width, h = grayscaled._height;
+    //5x5 window clamped at the borders like cimg_for5x5, bands of rows in parallel
+    parallel_for(0, h, 8, [&](int y0, int y1) {
+        uchar N[25];
+        cimg_forC(grayscaled, c) {
+            for (int y = y0; y < y1; y++) {
+                for (int x = 0; x < w; x++) {
+                    int k = 0;
+                    for (int dy = -2; dy <= 2; dy++) {
+                        const int yy = std::min(std::max(y + dy, 0), h - 1);
+                        for (int dx = -2; dx <= 2; dx++) {
+                            N[k++] = grayscaled(std::min(std::max(x + dx, 0), w - 1), yy, 0, c);
+                        }
+                    }
+                    std::nth_element(N, N + 12, N + 25);
+                    medianFiltered(x, y, c) = N[12];
+                }
+            }
         }
-    }
+    });
     
     grayscaled.assign(medianFiltered);
 
@@ -124,22 +143,23 @@ void Canny::useFilter(CImg<unsigned char> img_in, vector< vector<double> > filte
 {
     int size = (int)filterIn.size()/2;
     gFiltered = CImg<unsigned char>(img_in._width - 2*size, img_in._height - 2*size);
-	for (int i = size; i < img_in._width - size; i++)
-	{
-		for (int j = size; j < img_in._height - size; j++)
+    parallel_for(size, img_in._height - size, 16, [&](int j0, int j1) {
+		for (int j = j0; j < j1; j++)
 		{
-			double sum = 0;
-            
-			for (int x = 0; x < filterIn.size(); x++)
-				for (int y = 0; y < filterIn.size(); y++)
-				{
-                    sum += filterIn[x][y] * (double)(img_in(i + y - size, j + x - size));
-				}
-            
-            gFiltered(i-size, j-size) = sum;
+			for (int i = size; i < img_in._width - size; i++)
+			{
+				double sum = 0;
+                
+				for (int x = 0; x < filterIn.size(); x++)
+					for (int y = 0; y < filterIn.size(); y++)
+					{
+                        sum += filterIn[x][y] * (double)(img_in(i + y - size, j + x - size));
+					}
+                
+                gFiltered(i-size, j-size) = sum;
+			}
 		}
-
-	}
+    });
 
 }
 
@@ -173,34 +193,36 @@ void Canny::sobel_anglemap()
     
     angles = CImg<unsigned char>(gFiltered._width - 2*size, gFiltered._height - 2*size); //AngleMap
 
-	for (int i = size; i < gFiltered._height - size; i++)
-	{
-		for (int j = size; j < gFiltered._width - size; j++)
-		{
-			double sumx = 0;
-            double sumy = 0;
+    parallel_for(size, gFiltered._height - size, 16, [&](int i0, int i1) {
+    	for (int i = i0; i < i1; i++)
+    	{
+    		for (int j = size; j < gFiltered._width - size; j++)
+    		{
+    			double sumx = 0;
+                double sumy = 0;
             
-			for (int x = 0; x < xFilter.size(); x++)
-				for (int y = 0; y < xFilter.size(); y++)
-				{
-                    sumx += xFilter[x][y] * (double)(gFiltered(j + y - size, i + x - size)); //Sobel_X Filter Value
-                    sumy += yFilter[x][y] * (double)(gFiltered(j + y - size, i + x - size)); //Sobel_Y Filter Value
-				}
-            double sumxsq = sumx*sumx;
-            double sumysq = sumy*sumy;
+    			for (int x = 0; x < xFilter.size(); x++)
+    				for (int y = 0; y < xFilter.size(); y++)
+    				{
+                        sumx += xFilter[x][y] * (double)(gFiltered(j + y - size, i + x - size)); //Sobel_X Filter Value
+                        sumy += yFilter[x][y] * (double)(gFiltered(j + y - size, i + x - size)); //Sobel_Y Filter Value
+    				}
+                double sumxsq = sumx*sumx;
+                double sumysq = sumy*sumy;
             
-            double sq2 = sqrt(sumxsq + sumysq);
+                double sq2 = sqrt(sumxsq + sumysq);
             
-            if(sq2 > 255) //Unsigned Char Fix
-                sq2 =255;
-            sFiltered(j-size, i-size) = sq2;
+                if(sq2 > 255) //Unsigned Char Fix
+                    sq2 =255;
+                sFiltered(j-size, i-size) = sq2;
  
-            if(sumx==0) //Arctan Fix
-                angles(j-size, i-size) = 90;
-            else
-                angles(j-size, i-size) = atan(sumy/sumx) * 57.296f;
-		}
-	}
+                if(sumx==0) //Arctan Fix
+                    angles(j-size, i-size) = 90;
+                else
+                    angles(j-size, i-size) = atan(sumy/sumx) * 57.296f;
+    		}
+    	}
+    });
     
 }
 
@@ -208,41 +230,43 @@ void Canny::sobel_anglemap()
 void Canny::nonMaxSupp()
 {
     nonMaxSupped = CImg<unsigned char>(sFiltered._width-2, sFiltered._height-2);
-    for (int i=1; i< sFiltered._width - 1; i++) {
-        for (int j=1; j<sFiltered._height - 1; j++) {
-            float Tangent = angles(i,j);
-
-            nonMaxSupped(i-1, j-1) = sFiltered(i,j);
-            //Horizontal
-            if (((-22.5 < Tangent) && (Tangent <= 22.5)) || ((157.5 < Tangent) && (Tangent <= -157.5)))
-            {
-                if ((sFiltered(i,j) < sFiltered(i+1,j)) || (sFiltered(i,j) < sFiltered(i-1,j)))
-                    nonMaxSupped(i-1, j-1) = 0;
-            }
-            //Vertical
-            if (((-112.5 < Tangent) && (Tangent <= -67.5)) || ((67.5 < Tangent) && (Tangent <= 112.5)))
-            {
-                if ((sFiltered(i,j) < sFiltered(i,j+1)) || (sFiltered(i,j) < sFiltered(i,j-1)))
-                    nonMaxSupped(i-1, j-1) = 0;
-            }
+    parallel_for(1, sFiltered._width - 1, 16, [&](int i0, int i1) {
+        for (int i=i0; i< i1; i++) {
+            for (int j=1; j<sFiltered._height - 1; j++) {
+                float Tangent = angles(i,j);
+
+                nonMaxSupped(i-1, j-1) = sFiltered(i,j);
+                //Horizontal
+                if (((-22.5 < Tangent) && (Tangent <= 22.5)) || ((157.5 < Tangent) && (Tangent <= -157.5)))
+                {
+                    if ((sFiltered(i,j) < sFiltered(i+1,j)) || (sFiltered(i,j) < sFiltered(i-1,j)))
+                        nonMaxSupped(i-1, j-1) = 0;
+                }
+                //Vertical
+                if (((-112.5 < Tangent) && (Tangent <= -67.5)) || ((67.5 < Tangent) && (Tangent <= 112.5)))
+                {
+                    if ((sFiltered(i,j) < sFiltered(i,j+1)) || (sFiltered(i,j) < sFiltered(i,j-1)))
+                        nonMaxSupped(i-1, j-1) = 0;
+                }
             
-            //-45 Degree Edge
-            if (((-67.5 < Tangent) && (Tangent <= -22.5)) || ((112.5 < Tangent) && (Tangent <= 157.5)))
-            {
-                if ((sFiltered(i,j) < sFiltered(i+1,j+1)) || (sFiltered(i,j) < sFiltered(i-1,j-1)))
-                    nonMaxSupped(i-1, j-1) = 0;
+                //-45 Degree Edge
+                if (((-67.5 < Tangent) && (Tangent <= -22.5)) || ((112.5 < Tangent) && (Tangent <= 157.5)))
+                {
+                    if ((sFiltered(i,j) < sFiltered(i+1,j+1)) || (sFiltered(i,j) < sFiltered(i-1,j-1)))
+                        nonMaxSupped(i-1, j-1) = 0;
 
-            }
+                }
             
-            //45 Degree Edge
-            if (((-157.5 < Tangent) && (Tangent <= -112.5)) || ((22.5 < Tangent) && (Tangent <= 67.5)))
-            {
-                if ((sFiltered(i,j) < sFiltered(i-1,j+1)) || (sFiltered(i,j) < sFiltered(i+1,j-1)))
-                    nonMaxSupped(i-1, j-1) = 0;
+                //45 Degree Edge
+                if (((-157.5 < Tangent) && (Tangent <= -112.5)) || ((22.5 < Tangent) && (Tangent <= 67.5)))
+                {
+                    if ((sFiltered(i,j) < sFiltered(i-1,j+1)) || (sFiltered(i,j) < sFiltered(i+1,j-1)))
+                        nonMaxSupped(i-1, j-1) = 0;
+                }
             }
-        }
 
-    }
+        }
+    });
 
 }
 
@@ -0,0 +1,143 @@
+//
+//  Cascade.cpp
+//  DigitScanner
+//
+
+#include "headers.h"
+#include "Cascade.hpp"
+
+#include <random>
+#include <limits>
+#include <algorithm>
+#include <stdint.h>
+#include <string.h>
+
+Cascade::Cascade() {
+    margin = 4.f;
+    dim = classes = 0;
+}
+
+void Cascade::train(const float* input, const int* labels, int n, int dim, int classes, int epochs) {
+
+    this->dim = dim;
+    this->classes = classes;
+    kernel.assign((size_t)dim * classes, 0.f);
+    bias.assign(classes, 0.f);
+
+    MapMatrixf w(kernel.data(), dim, classes);
+    Eigen::Map<Eigen::RowVectorXf> b(bias.data(), classes);
+    RowMatrixf dw = RowMatrixf::Zero(dim, classes), batch_x;
+    Eigen::RowVectorXf db = Eigen::RowVectorXf::Zero(classes);
+
+    std::vector<int> order(n);
+    for (int i = 0; i < n; i++) {
+        order[i] = i;
+    }
+    std::mt19937 rng(1);
+
+    //Momentum SGD on the cross entropy, small L2 on the kernel
+    const int batch = 100;
+    const float momentum = 0.9f, decay = 1e-4f;
+    for (int e = 0; e < epochs; e++) {
+        const float rate = 0.05f / (1 + e);
+        std::shuffle(order.begin(), order.end(), rng);
+        for (int i = 0; i < n; i += batch) {
+            const int m = std::min(batch, n - i);
+            batch_x.resize(m, dim);
+            for (int r = 0; r < m; r++) {
+                batch_x.row(r) = Eigen::Map<const Eigen::RowVectorXf>(input + (size_t)order[i + r] * dim, dim);
+            }
+
+            //Softmax minus one hot
+            RowMatrixf p = (batch_x * w).rowwise() + b;
+            p.colwise() -= p.rowwise().maxCoeff();
+            p = p.array().exp().matrix();
+            p.array().colwise() /= p.rowwise().sum().array();
+            for (int r = 0; r < m; r++) {
+                p(r, labels[order[i + r]]) -= 1.f;
+            }
+
+            dw = momentum * dw + rate * ((batch_x.transpose() * p) / m + decay * w);
+            db = momentum * db + rate * p.colwise().sum() / m;
+            w -= dw;
+            b -= db;
+        }
+    }
+}
+
+bool Cascade::save(const char* path) const {
+
+    if (!ready()) {
+        return false;
+    }
+    std::ofstream ofs(path, std::ofstream::binary);
+    const uint32_t version = 1, dims[2] = { (uint32_t)dim, (uint32_t)classes };
+    ofs.write("DLIN", 4);
+    ofs.write((const char*)&version, sizeof(version));
+    ofs.write((const char*)dims, sizeof(dims));
+    ofs.write((const char*)kernel.data(), kernel.size() * sizeof(float));
+    ofs.write((const char*)bias.data(), bias.size() * sizeof(float));
+    return (bool)ofs;
+}
+
+bool Cascade::load(const char* path) {
+
+    classes = 0;
+    std::ifstream ifs(path, std::ifstream::binary);
+    if (!ifs) {
+        return false;
+    }
+
+    char magic[4];
+    uint32_t version = 0, dims[2] = { 0, 0 };
+    ifs.read(magic, 4);
+    ifs.read((char*)&version, sizeof(version));
+    ifs.read((char*)dims, sizeof(dims));
+    if (!ifs || memcmp(magic, "DLIN", 4) != 0 || version != 1 || dims[0] == 0 || dims[1] < 2) {
+        return false;
+    }
+
+    kernel.resize((size_t)dims[0] * dims[1]);
+    bias.resize(dims[1]);
+    ifs.read((char*)kernel.data(), kernel.size() * sizeof(float));
+    ifs.read((char*)bias.data(), bias.size() * sizeof(float));
+    if (!ifs) {
+        return false;
+    }
+
+    dim = dims[0];
+    classes = dims[1];
+    return true;
+}
+
+int Cascade::classify(const float* input, int n, int* labels, std::vector<float>& logits) const {
+
+    if (!ready()) {
+        std::fill(labels, labels + n, -1);
+        return 0;
+    }
+
+    logits.resize((size_t)n * classes);
+    MapMatrixf l(logits.data(), n, classes);
+    l.noalias() = ConstMapMatrixf(input, n, dim) * ConstMapMatrixf(kernel.data(), dim, classes);
+    l.rowwise() += Eigen::Map<const Eigen::RowVectorXf>(bias.data(), classes);
+
+    int answered = 0;
+    for (int r = 0; r < n; r++) {
+        const float* row = &logits[(size_t)r * classes];
+        int top = 0;
+        float second = -std::numeric_limits<float>::infinity();
+        for (int c = 1; c < classes; c++) {
+            if (row[c] > row[top]) {
+                second = row[top];
+                top = c;
+            }
+            else if (row[c] > second) {
+                second = row[c];
+            }
+        }
+        labels[r] = row[top] - second >= margin ? top : -1;
+        answered += labels[r] >= 0;
+    }
+    return answered;
+}
@@ -0,0 +1,66 @@
+//
+//  Cascade.hpp
+//  DigitScanner
+//
+//  Cheap first stage in front of the SVM / CNN classifiers: a linear
+//  softmax model on the 28x28 digit. Digits whose top two logits are
+//  at least margin apart keep its answer, the rest escalate to the
+//  full classifier. Trained by tools/cascade_train.
+//
+
+#ifndef Cascade_hpp
+#define Cascade_hpp
+
+#include <vector>
+
+class Cascade {
+
+public:
+
+    Cascade();
+
+    /**
+     *  train():
+     *  Softmax regression by minibatch SGD.
+     *  @param
+     *  input: n x dim, row major
+     *  labels: n values in 0..classes-1
+     */
+    void train(const float* input, const int* labels, int n, int dim, int classes, int epochs = 10);
+
+    /**
+     *  save() / load():
+     *  File layout, little endian:
+     *  "DLIN", uint32 version, uint32 input dim, uint32 classes,
+     *  float32 kernel[input dim x classes], float32 bias[classes].
+     */
+    bool save(const char* path) const;
+    bool load(const char* path);
+
+    /**
+     *  classify():
+     *  First stage over a batch, may run on many threads at once.
+     *  @param
+     *  input: n x input dim, row major
+     *  labels: n results, -1 where the digit has to escalate
+     *  logits: scratch, n x classes on return
+     *  @return
+     *  number of digits answered
+     */
+    int classify(const float* input, int n, int* labels, std::vector<float>& logits) const;
+
+    //Top two logit gap needed to answer without escalating
+    float margin;
+
+    bool ready() const { return classes > 0; }
+    int input_dim() const { return dim; }
+    int num_classes() const { return classes; }
+
+private:
+
+    int dim, classes;
+    std::vector<float> kernel;  //dim x classes
+    std::vector<float> bias;    //classes
+};
+
+#endif /* Cascade_hpp */
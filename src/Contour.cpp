@@ -11,7 +11,7 @@
 
 namespace ct {
     
-    Contour::Contour(CImg<float>& img) {
+    Contour::Contour(CImg<float>& img, const DisplayPolicy& disp) {
         
         //Gray Image, and binarilized is required.
         assert(img._spectrum == 1);
@@ -23,7 +23,7 @@ namespace ct {
         _img.threshold(0.5);
         _img = 1 - _img;
 
-        _img.display();
+        disp.display(_img);
         
         nextLabel = 0;
         
@@ -14,7 +14,7 @@
 #include <cassert>
 #include <cmath>
 #include <random>
-#include "CImg.h"
+#include "DebugDisplay.hpp"
 
 namespace ct {
     using namespace cimg_library;
@@ -129,7 +129,7 @@ namespace ct {
     public:
         
         //Gray Image, and binarilized is required.
-        Contour(CImg<float>& img);
+        Contour(CImg<float>& img, const DisplayPolicy& disp = DisplayPolicy());
         
         vector<Rect> extractRegions();
         
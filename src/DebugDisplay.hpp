@@ -0,0 +1,45 @@
+//
+//  DebugDisplay.hpp
+//  DigitScanner
+//
+//  Debug visualization policy.
+//
+//  Build with -DDIGITSCANNER_HEADLESS to compile CImg without any
+//  display backend (cimg_display 0), which also drops the X11
+//  dependency. At runtime, windows are only opened when a
+//  DisplayPolicy is enabled, which is off by default.
+//
+
+#ifndef DebugDisplay_hpp
+#define DebugDisplay_hpp
+
+#ifdef DIGITSCANNER_HEADLESS
+#ifndef cimg_display
+#define cimg_display 0
+#endif
+#endif
+
+#include "CImg.h"
+
+struct DisplayPolicy
+{
+    bool show;
+    
+    explicit DisplayPolicy(bool _show = false) : show(_show) {}
+    
+    //True only if windows are both requested and compiled in.
+    //Check this before drawing into a copy just to look at it.
+    bool enabled() const
+    {
+        return cimg_display != 0 && show;
+    }
+    
+    template <typename T>
+    void display(const cimg_library::CImg<T>& img) const
+    {
+        if (enabled())
+            img.display();
+    }
+};
+
+#endif /* DebugDisplay_hpp */
@@ -0,0 +1,315 @@
+//
+//  DenseSVM.cpp
+//  DigitScanner
+//
+
+#include "headers.h"
+#include "DenseSVM.hpp"
+
+#include <string.h>
+#include <random>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+//Rows scored per GEMM, bounds the batch x l kernel matrix
+static const int SVM_BLOCK = 128;
+
+static uint64_t align64(uint64_t offset) {
+    return (offset + 63) / 64 * 64;
+}
+
+//Section offsets of a model file
+static void layout(DenseSVMHeader& h) {
+    h.sv = align64(sizeof(DenseSVMHeader));
+    h.sv_norm = align64(h.sv + (uint64_t)h.l * h.dim * sizeof(float));
+    h.coef = align64(h.sv_norm + (uint64_t)h.l * sizeof(float));
+    h.rho = align64(h.coef + (uint64_t)h.l * h.pairs * sizeof(float));
+    h.label = align64(h.rho + (uint64_t)h.pairs * sizeof(float));
+    h.size = h.label + (uint64_t)h.nr_class * sizeof(int32_t);
+}
+
+DenseSVM::DenseSVM() {
+    mapped = NULL;
+    mapped_size = 0;
+    header = NULL;
+    rff = 0;
+    sv = sv_norm = coef = rho = NULL;
+    label = NULL;
+}
+
+DenseSVM::~DenseSVM() {
+    release();
+}
+
+void DenseSVM::release() {
+    if (mapped != NULL) {
+        munmap(mapped, mapped_size);
+        mapped = NULL;
+        mapped_size = 0;
+    }
+    owned.clear();
+    header = NULL;
+    rff = 0;
+    omega.clear();
+    phase.clear();
+    rff_weight.clear();
+}
+
+bool DenseSVM::bind(const void* image, size_t size) {
+
+    const DenseSVMHeader* h = (const DenseSVMHeader*)image;
+    if (size < sizeof(DenseSVMHeader) || memcmp(h->magic, "DSVM", 4) != 0 ||
+        h->version != DENSE_SVM_VERSION || h->nr_class < 2 ||
+        h->pairs != h->nr_class * (h->nr_class - 1) / 2) {
+        return false;
+    }
+
+    //Offsets have to be the ones this build would write
+    DenseSVMHeader expect = *h;
+    layout(expect);
+    if (memcmp(&expect, h, sizeof(DenseSVMHeader)) != 0 || h->size > size) {
+        return false;
+    }
+
+    const char* base = (const char*)image;
+    header = h;
+    sv = (const float*)(base + h->sv);
+    sv_norm = (const float*)(base + h->sv_norm);
+    coef = (const float*)(base + h->coef);
+    rho = (const float*)(base + h->rho);
+    label = (const int32_t*)(base + h->label);
+    return true;
+}
+
+bool DenseSVM::init(const svm_model* model, int dim) {
+
+    release();
+    if (model == NULL ||
+        (model->param.svm_type != C_SVC && model->param.svm_type != NU_SVC) ||
+        model->param.kernel_type != RBF || model->nr_class < 2) {
+        return false;
+    }
+
+    DenseSVMHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, "DSVM", 4);
+    h.version = DENSE_SVM_VERSION;
+    h.dim = dim;
+    h.l = model->l;
+    h.nr_class = model->nr_class;
+    h.pairs = h.nr_class * (h.nr_class - 1) / 2;
+    h.gamma = (float)model->param.gamma;
+    layout(h);
+
+    owned.assign((h.size + sizeof(uint64_t) - 1) / sizeof(uint64_t), 0);
+    char* base = (char*)owned.data();
+    memcpy(base, &h, sizeof(h));
+    float* sv_w = (float*)(base + h.sv);
+    float* norm_w = (float*)(base + h.sv_norm);
+    float* coef_w = (float*)(base + h.coef);
+    float* rho_w = (float*)(base + h.rho);
+    int32_t* label_w = (int32_t*)(base + h.label);
+
+    //SVs are sparse, indices past dim never meet an input value
+    const int l = model->l;
+    for (int i = 0; i < l; i++) {
+        double norm = 0;
+        for (const svm_node* p = model->SV[i]; p->index != -1; p++) {
+            norm += p->value * p->value;
+            if (p->index >= 0 && p->index < dim) {
+                sv_w[(size_t)i * dim + p->index] = (float)p->value;
+            }
+        }
+        norm_w[i] = (float)norm;
+    }
+
+    //Pair (i, j) weighs class i SVs by sv_coef[j - 1] and class j SVs
+    //by sv_coef[i], see svm_predict_values()
+    const int nr_class = model->nr_class;
+    const int pairs = h.pairs;
+    std::vector<int> start(nr_class, 0);
+    for (int i = 1; i < nr_class; i++) {
+        start[i] = start[i-1] + model->nSV[i-1];
+    }
+    int p = 0;
+    for (int i = 0; i < nr_class; i++) {
+        for (int j = i + 1; j < nr_class; j++, p++) {
+            for (int k = start[i]; k < start[i] + model->nSV[i]; k++) {
+                coef_w[(size_t)k * pairs + p] = (float)model->sv_coef[j-1][k];
+            }
+            for (int k = start[j]; k < start[j] + model->nSV[j]; k++) {
+                coef_w[(size_t)k * pairs + p] = (float)model->sv_coef[i][k];
+            }
+            rho_w[p] = (float)model->rho[p];
+        }
+    }
+
+    for (int i = 0; i < nr_class; i++) {
+        label_w[i] = model->label[i];
+    }
+
+    return bind(base, h.size);
+}
+
+bool DenseSVM::save(const char* path) const {
+
+    if (!ready()) {
+        return false;
+    }
+    std::ofstream ofs(path, std::ofstream::binary);
+    ofs.write((const char*)header, header->size);
+    return (bool)ofs;
+}
+
+bool DenseSVM::map(const char* path) {
+
+    release();
+
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(DenseSVMHeader)) {
+        close(fd);
+        return false;
+    }
+    void* image = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (image == MAP_FAILED) {
+        return false;
+    }
+
+    mapped = image;
+    mapped_size = st.st_size;
+    if (!bind(image, mapped_size)) {
+        release();
+        return false;
+    }
+    return true;
+}
+
+bool DenseSVM::approximate(int features, unsigned seed) {
+
+    if (!ready()) {
+        return false;
+    }
+    rff = 0;
+    omega.clear();
+    phase.clear();
+    rff_weight.clear();
+    if (features <= 0) {
+        return true;
+    }
+
+    const int dim = header->dim;
+    const int l = header->l;
+    const int pairs = header->pairs;
+
+    std::mt19937 rng(seed);
+    std::normal_distribution<float> normal(0.f, std::sqrt(2.f * header->gamma));
+    std::uniform_real_distribution<float> uniform(0.f, 2.f * (float)M_PI);
+    omega.resize((size_t)dim * features);
+    for (size_t i = 0; i < omega.size(); i++) {
+        omega[i] = normal(rng);
+    }
+    phase.resize(features);
+    for (int i = 0; i < features; i++) {
+        phase[i] = uniform(rng);
+    }
+
+    ConstMapMatrixf w(omega.data(), dim, features);
+    Eigen::Map<const Eigen::RowVectorXf> b(phase.data(), features);
+
+    //Features of the SVs a block at a time, folded into the pair weights
+    rff_weight.assign((size_t)features * pairs, 0.f);
+    MapMatrixf weight(rff_weight.data(), features, pairs);
+    RowMatrixf z;
+    for (int s0 = 0; s0 < l; s0 += SVM_BLOCK) {
+        const int n = std::min(SVM_BLOCK, l - s0);
+        z.noalias() = ConstMapMatrixf(sv + (size_t)s0 * dim, n, dim) * w;
+        z = (z.rowwise() + b).array().cos().matrix();
+        weight.noalias() += z.transpose() * ConstMapMatrixf(coef + (size_t)s0 * pairs, n, pairs);
+    }
+    weight *= 2.f / features;
+
+    rff = features;
+    return true;
+}
+
+void DenseSVM::vote(const float* dec, int n, int* predictions) const {
+
+    const int nr_class = header->nr_class;
+    const int pairs = header->pairs;
+    std::vector<int> votes(nr_class);
+    for (int r = 0; r < n; r++) {
+        const float* d = dec + (size_t)r * pairs;
+        std::fill(votes.begin(), votes.end(), 0);
+        int p = 0;
+        for (int i = 0; i < nr_class; i++) {
+            for (int j = i + 1; j < nr_class; j++, p++) {
+                ++votes[d[p] > 0 ? i : j];
+            }
+        }
+        predictions[r] = label[std::max_element(votes.begin(), votes.end()) - votes.begin()];
+    }
+}
+
+std::vector<int> DenseSVM::predict(const float* input, int batch) const {
+
+    std::vector<int> predictions(batch, -1);
+    if (!ready()) {
+        fprintf(stderr, "ERROR: SVM model is not loaded.\n");
+        return predictions;
+    }
+
+    const int dim = header->dim;
+    const int l = header->l;
+    const int pairs = header->pairs;
+    const float gamma = header->gamma;
+
+    ConstMapMatrixf svs(sv, l, dim);
+    Eigen::Map<const Eigen::RowVectorXf> s_norm(sv_norm, l);
+    ConstMapMatrixf coefs(coef, l, pairs);
+    Eigen::Map<const Eigen::RowVectorXf> rhos(rho, pairs);
+
+    //Scratch per call, so threads can share the model
+    std::vector<float> kvalue, dec, x_norm;
+
+    for (int b0 = 0; b0 < batch; b0 += SVM_BLOCK) {
+        const int n = std::min(SVM_BLOCK, batch - b0);
+        ConstMapMatrixf x(input + (size_t)b0 * dim, n, dim);
+        dec.resize((size_t)n * pairs);
+        MapMatrixf d(dec.data(), n, pairs);
+
+        if (rff) {
+            //cos(W x + b) against the folded pair weights
+            kvalue.resize((size_t)n * rff);
+            MapMatrixf z(kvalue.data(), n, rff);
+            z.noalias() = x * ConstMapMatrixf(omega.data(), dim, rff);
+            z = (z.rowwise() + Eigen::Map<const Eigen::RowVectorXf>(phase.data(), rff)).array().cos().matrix();
+            d.noalias() = z * ConstMapMatrixf(rff_weight.data(), rff, pairs);
+        }
+        else {
+            //exp(-gamma |x - s|^2), clamped at 0 against rounding
+            kvalue.resize((size_t)n * l);
+            x_norm.resize(n);
+            MapMatrixf k(kvalue.data(), n, l);
+            Eigen::Map<Eigen::VectorXf> xn(x_norm.data(), n);
+            xn = x.rowwise().squaredNorm();
+            k.noalias() = x * svs.transpose();
+            k = ((-2.f * k).rowwise() + s_norm).colwise() + xn;
+            k = (k.array().max(0.f) * -gamma).exp().matrix();
+
+            //All pair decision values at once
+            d.noalias() = k * coefs;
+        }
+        d.rowwise() -= rhos;
+
+        vote(dec.data(), n, &predictions[b0]);
+    }
+
+    return predictions;
+}
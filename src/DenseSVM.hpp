@@ -0,0 +1,145 @@
+//
+//  DenseSVM.hpp
+//  DigitScanner
+//
+//  Batched prediction for a libsvm one-vs-one RBF classifier.
+//
+//  Support vectors are kept as a dense float32 matrix with their
+//  squared norms, so the kernel values of a whole batch against all
+//  SVs are one GEMM: |x - s|^2 = |x|^2 + |s|^2 - 2 x.s. A second GEMM
+//  against the coefficients, laid out as one column per class pair,
+//  gives every decision value before the vote.
+//
+//  approximate() swaps the kernel for D random Fourier features,
+//  z(x) = cos(W x + b) with W ~ N(0, 2 gamma), K(x, s) ~ 2 / D z(x).z(s).
+//  Each decision function then collapses to one D vector computed
+//  from the SVs, so a digit costs dim x D + D x pairs instead of
+//  dim x l, at some accuracy.
+//
+//  The arrays live in one image with the layout of the binary model
+//  file, built in memory by init() or mapped read only by map(), so
+//  processes on a host share the pages of a mapped model.
+//
+
+#ifndef DenseSVM_hpp
+#define DenseSVM_hpp
+
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+#include <svm.h>
+
+/**
+ *  Binary model file, native byte order (little endian):
+ *  this header, then float32 sv (l x dim), sv_norm (l),
+ *  coef (l x pairs), rho (pairs) and int32 label (nr_class),
+ *  each at the byte offset given here, 64 byte aligned.
+ */
+struct DenseSVMHeader {
+    char magic[4];          //"DSVM"
+    uint32_t version;       //DENSE_SVM_VERSION
+    uint32_t dim, l, nr_class, pairs;
+    float gamma;
+    uint32_t reserved;
+    uint64_t sv, sv_norm, coef, rho, label;
+    uint64_t size;          //whole file
+};
+
+const uint32_t DENSE_SVM_VERSION = 1;
+
+class DenseSVM {
+
+public:
+
+    DenseSVM();
+    ~DenseSVM();
+
+    /**
+     *  init():
+     *  Copy a loaded libsvm model into the dense layout.
+     *  @param
+     *  dim: feature count of the inputs, indices 0..dim-1
+     *  @return
+     *  false unless model is a C_SVC / NU_SVC with an RBF kernel,
+     *  svm_predict() has to be used then
+     */
+    bool init(const svm_model* model, int dim);
+
+    /**
+     *  save():
+     *  Write the model as a binary model file for map().
+     */
+    bool save(const char* path) const;
+
+    /**
+     *  map():
+     *  Map a binary model file read only, replacing the current model.
+     *  @return
+     *  false if the file is missing, truncated or of another version
+     */
+    bool map(const char* path);
+
+    /**
+     *  predict():
+     *  Classify a batch of dense feature rows.
+     *  @param
+     *  input: batch * dim floats, row major
+     *  @return
+     *  label of each row, as svm_predict() would vote
+     */
+    std::vector<int> predict(const float* input, int batch) const;
+
+    /**
+     *  approximate():
+     *  Let predict() use random Fourier features instead of the
+     *  exact kernel, until the next init() / map().
+     *  @param
+     *  features: D, more is closer to exact and slower, 0 goes back
+     *  to the exact kernel
+     *  seed: of the random projection
+     *  @return
+     *  false before init() / map()
+     */
+    bool approximate(int features, unsigned seed = 1);
+
+    //D of approximate(), 0 when exact
+    int features() const { return rff; }
+
+    bool ready() const { return header != NULL; }
+
+    int dimension() const { return ready() ? (int)header->dim : 0; }
+
+private:
+
+    DenseSVM(const DenseSVM&);
+    DenseSVM& operator=(const DenseSVM&);
+
+    //Image of the model file, owned or mapped
+    std::vector<uint64_t> owned;
+    void* mapped;
+    size_t mapped_size;
+
+    //Into the image, NULL before init() / map()
+    const DenseSVMHeader* header;
+    const float* sv;
+    const float* sv_norm;
+    const float* coef;
+    const float* rho;
+    const int32_t* label;
+
+    //Checks the header of an image and points the arrays into it
+    bool bind(const void* image, size_t size);
+
+    void release();
+
+    //Random Fourier features, empty when exact
+    int rff;
+    std::vector<float> omega;       //dim x rff
+    std::vector<float> phase;       //rff
+    std::vector<float> rff_weight;  //rff x pairs, 2 / D sum of coef z(sv)
+
+    //One vote per pair of each row of decision values
+    void vote(const float* dec, int n, int* predictions) const;
+};
+
+#endif /* DenseSVM_hpp */
@@ -0,0 +1,134 @@
+//
+//  DigitCache.cpp
+//  DigitScanner
+//
+
+#include "DigitCache.hpp"
+#include <string.h>
+
+bool DigitKey::operator==(const DigitKey& other) const {
+    return version == other.version && memcmp(bits, other.bits, sizeof(bits)) == 0;
+}
+
+size_t DigitKeyHash::operator()(const DigitKey& key) const {
+    
+    //Multiply and fold per word, then a final avalanche so the low bits
+    //used by the buckets and the high bits used by the shards both mix
+    uint64_t h = 0x9e3779b97f4a7c15ull ^ key.version;
+    for (int i = 0; i < DIGIT_KEY_WORDS; i++) {
+        h = (h ^ key.bits[i]) * 0xff51afd7ed558ccdull;
+        h ^= h >> 32;
+    }
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return (size_t)h;
+}
+
+DigitCache::DigitCache() : capacity(0), hit_count(0), miss_count(0) {
+    for (int s = 0; s < SHARDS; s++) {
+        shards[s].capacity = 0;
+        shards[s].hand = 0;
+    }
+}
+
+void DigitCache::init(size_t capacity) {
+    
+    this->capacity = capacity;
+    for (int s = 0; s < SHARDS; s++) {
+        Shard& shard = shards[s];
+        std::lock_guard<std::mutex> guard(shard.lock);
+        shard.capacity = capacity == 0 ? 0 : (capacity + SHARDS - 1) / SHARDS;
+        shard.hand = 0;
+        shard.index.clear();
+        shard.index.reserve(shard.capacity);
+        std::vector<Entry>().swap(shard.entries);
+        shard.entries.reserve(shard.capacity);
+    }
+    hit_count = 0;
+    miss_count = 0;
+}
+
+DigitKey DigitCache::key(const float* digit, uint32_t version) {
+    
+    DigitKey key;
+    memset(key.bits, 0, sizeof(key.bits));
+    key.version = version;
+    for (int i = 0; i < 28 * 28; i++) {
+        if (digit[i] > 0.5f)
+            key.bits[i >> 6] |= 1ull << (i & 63);
+    }
+    return key;
+}
+
+DigitCache::Shard& DigitCache::shard(const DigitKey& key) {
+    return shards[(DigitKeyHash()(key) >> 60) % SHARDS];
+}
+
+bool DigitCache::lookup(const DigitKey& key, int& label) {
+    
+    if (!enabled())
+        return false;
+    
+    Shard& s = shard(key);
+    {
+        std::lock_guard<std::mutex> guard(s.lock);
+        auto it = s.index.find(key);
+        if (it != s.index.end()) {
+            Entry& e = s.entries[it->second];
+            e.referenced = true;
+            label = e.label;
+            hit_count++;
+            return true;
+        }
+    }
+    miss_count++;
+    return false;
+}
+
+void DigitCache::insert(const DigitKey& key, int label) {
+    
+    if (!enabled())
+        return;
+    
+    Shard& s = shard(key);
+    std::lock_guard<std::mutex> guard(s.lock);
+    
+    auto it = s.index.find(key);
+    if (it != s.index.end()) {
+        s.entries[it->second].label = label;
+        return;
+    }
+    
+    uint32_t slot;
+    if (s.entries.size() < s.capacity) {
+        slot = (uint32_t)s.entries.size();
+        s.entries.push_back(Entry());
+    }
+    else {
+        //Second chance: skip and clear referenced entries
+        while (s.entries[s.hand].referenced) {
+            s.entries[s.hand].referenced = false;
+            s.hand = (s.hand + 1) % s.entries.size();
+        }
+        slot = (uint32_t)s.hand;
+        s.hand = (s.hand + 1) % s.entries.size();
+        s.index.erase(s.entries[slot].key);
+    }
+    
+    Entry& e = s.entries[slot];
+    e.key = key;
+    e.label = label;
+    e.referenced = false;
+    s.index[key] = slot;
+}
+
+size_t DigitCache::size() const {
+    
+    size_t total = 0;
+    for (int s = 0; s < SHARDS; s++) {
+        std::lock_guard<std::mutex> guard(shards[s].lock);
+        total += shards[s].index.size();
+    }
+    return total;
+}
@@ -0,0 +1,109 @@
+//
+//  DigitCache.hpp
+//  DigitScanner
+//
+//  Prediction cache keyed by the content of the normalized digit.
+//  Preprocessed digits are binary 28x28 maps, and repeated tokens on
+//  forms (printed zeros, boxes, IDs) often come out bit identical, so
+//  the 784 pixels are packed into 13 words and used as the key, with
+//  the version of the classifier that produced the label.
+//
+//  Memory is bounded by the entry count given to init(). Entries are
+//  spread over shards with their own lock and evicted by CLOCK: a hit
+//  sets the entry's reference bit, the hand clears bits until it finds
+//  an entry that was not used since its last pass.
+//
+
+#ifndef DigitCache_hpp
+#define DigitCache_hpp
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+
+const int DIGIT_KEY_WORDS = (28 * 28 + 63) / 64;
+
+struct DigitKey {
+    uint64_t bits[DIGIT_KEY_WORDS];
+    uint32_t version;
+
+    bool operator==(const DigitKey& other) const;
+};
+
+struct DigitKeyHash {
+    size_t operator()(const DigitKey& key) const;
+};
+
+class DigitCache {
+
+public:
+
+    DigitCache();
+
+    /**
+     *  init():
+     *  Drop all entries and bound the cache, 0 disables it.
+     *  @param
+     *  capacity: entries over all shards
+     */
+    void init(size_t capacity);
+
+    bool enabled() const { return capacity > 0; }
+
+    /**
+     *  key():
+     *  Pack a preprocessed digit, pixels above 0.5 are set.
+     *  @param
+     *  digit: 28 x 28 values
+     *  version: classifier the label comes from
+     */
+    static DigitKey key(const float* digit, uint32_t version);
+
+    /**
+     *  lookup():
+     *  @return
+     *  true and the cached label, false on a miss or when disabled
+     */
+    bool lookup(const DigitKey& key, int& label);
+
+    //Adds or replaces an entry, evicting one when the shard is full
+    void insert(const DigitKey& key, int label);
+
+    //Counts over all lookups since init()
+    uint64_t hits() const { return hit_count; }
+    uint64_t misses() const { return miss_count; }
+
+    size_t size() const;
+
+private:
+
+    static const int SHARDS = 16;
+
+    struct Entry {
+        DigitKey key;
+        int label;
+        bool referenced;
+    };
+
+    struct Shard {
+        mutable std::mutex lock;
+        std::unordered_map<DigitKey, uint32_t, DigitKeyHash> index;
+        std::vector<Entry> entries;
+        size_t capacity;
+        size_t hand;
+    };
+
+    size_t capacity;
+    Shard shards[SHARDS];
+    std::atomic<uint64_t> hit_count, miss_count;
+
+    Shard& shard(const DigitKey& key);
+
+    DigitCache(const DigitCache&);
+    DigitCache& operator=(const DigitCache&);
+};
+
+#endif /* DigitCache_hpp */
@@ -0,0 +1,151 @@
+//
+//  DigitPreprocess.cpp
+//  DigitScanner
+//
+
+#include "DigitPreprocess.hpp"
+#include <algorithm>
+
+void DigitPreprocessor::buildTable(AxisTable& table, int src_size, int dst_size)
+{
+    table.size = src_size;
+    table.dst_size = dst_size;
+    table.begin.clear();
+    table.taps.clear();
+
+    if (src_size == dst_size || src_size == 1)
+    {
+        //Copy, or replicate a single pixel
+        for (int i = 0; i < dst_size; i++)
+        {
+            table.begin.push_back((int)table.taps.size());
+            table.taps.push_back({src_size == 1 ? 0 : i, 1.f});
+        }
+        table.norm = 1.f;
+    }
+    else if (src_size > dst_size)
+    {
+        //Shrinking, CImg falls back to moving average: every source
+        //pixel is split over the outputs it overlaps, in units of 1/src_size.
+        unsigned int b = src_size, c = dst_size;
+        int s = 0, t = 0;
+        table.begin.push_back(0);
+        for (unsigned int a = src_size * dst_size; a; )
+        {
+            const unsigned int d = std::min(b, c);
+            a -= d; b -= d; c -= d;
+            table.taps.push_back({s, (float)d});
+            if (!b)
+            {
+                t++;
+                if (t < dst_size)
+                    table.begin.push_back((int)table.taps.size());
+                b = src_size;
+            }
+            if (!c) { s++; c = dst_size; }
+        }
+        table.norm = (float)src_size;
+    }
+    else
+    {
+        //Enlarging, linear interpolation with the end points aligned,
+        //stepping in float exactly as CImg does.
+        const float f = dst_size > 1 ? (src_size - 1.f) / (dst_size - 1) : 0.f;
+        float curr = 0, old = 0;
+        int s = 0;
+        for (int i = 0; i < dst_size; i++)
+        {
+            const float alpha = curr - (unsigned int)curr;
+            table.begin.push_back((int)table.taps.size());
+            table.taps.push_back({s, 1 - alpha});
+            table.taps.push_back({s < src_size - 1 ? s + 1 : s, alpha});
+            old = curr;
+            curr += f;
+            s += (unsigned int)curr - (unsigned int)old;
+        }
+        table.norm = 1.f;
+    }
+    table.begin.push_back((int)table.taps.size());
+}
+
+void DigitPreprocessor::process(const CImg<unsigned char>& image, const Rect& region, int padding, float* out)
+{
+    process(image, region, padding, DIGIT_SIZE, DIGIT_SIZE, out);
+}
+
+void DigitPreprocessor::process(const CImg<unsigned char>& image, const Rect& region, int padding,
+                                int out_w, int out_h, float* out)
+{
+    const int w = std::max(region.width, 0);
+    const int h = std::max(region.height, 0);
+    const int pw = w + 2 * padding;
+    const int ph = h + 2 * padding;
+
+    //Weight tables only depend on the padded and output sizes
+    if (xTable.begin.empty() || xTable.size != pw || xTable.dst_size != out_w)
+        buildTable(xTable, pw, out_w);
+    if (yTable.begin.empty() || yTable.size != ph || yTable.dst_size != out_h)
+        buildTable(yTable, ph, out_h);
+
+    //Binarize and negate into the padded mask.
+    //Same luma as RGBtoYCbCr: Y = (66R + 129G + 25B + 128) / 256 + 16 < 128.
+    ink.assign((size_t)pw * ph, 0);
+
+    const int x0 = std::max(region.x, 0);
+    const int x1 = std::min(region.x + w, image.width());
+    const int y0 = std::max(region.y, 0);
+    const int y1 = std::min(region.y + h, image.height());
+    const bool rgb = image.spectrum() >= 3;
+
+    for (int sy = y0; sy < y1; sy++)
+    {
+        unsigned char* m = &ink[(size_t)(sy - region.y + padding) * pw + padding + x0 - region.x];
+        const int n = x1 - x0;
+        if (rgb)
+        {
+            const unsigned char* r = image.data(x0, sy, 0, 0);
+            const unsigned char* g = image.data(x0, sy, 0, 1);
+            const unsigned char* b = image.data(x0, sy, 0, 2);
+            for (int i = 0; i < n; i++)
+                m[i] = (66 * r[i] + 129 * g[i] + 25 * b[i]) < 28544;
+        }
+        else
+        {
+            const unsigned char* v = image.data(x0, sy);
+            for (int i = 0; i < n; i++)
+                m[i] = v[i] < 128;
+        }
+    }
+
+    //Resample rows in x
+    rows.resize((size_t)ph * out_w);
+    for (int y = 0; y < ph; y++)
+    {
+        const unsigned char* m = &ink[(size_t)y * pw];
+        float* dst = &rows[(size_t)y * out_w];
+        for (int i = 0; i < out_w; i++)
+        {
+            float acc = 0;
+            for (int k = xTable.begin[i]; k < xTable.begin[i+1]; k++)
+                acc += m[xTable.taps[k].src] * xTable.taps[k].weight;
+            dst[i] = acc / xTable.norm;
+        }
+    }
+
+    //Resample columns in y and rethreshold
+    for (int j = 0; j < out_h; j++)
+    {
+        float* dst = out + (size_t)j * out_w;
+        for (int i = 0; i < out_w; i++)
+            dst[i] = 0;
+        for (int k = yTable.begin[j]; k < yTable.begin[j+1]; k++)
+        {
+            const float* src = &rows[(size_t)yTable.taps[k].src * out_w];
+            const float weight = yTable.taps[k].weight;
+            for (int i = 0; i < out_w; i++)
+                dst[i] += src[i] * weight;
+        }
+        for (int i = 0; i < out_w; i++)
+            dst[i] = dst[i] / yTable.norm >= 0.65f ? 1.f : 0.f;
+    }
+}
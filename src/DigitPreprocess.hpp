@@ -0,0 +1,79 @@
+//
+//  DigitPreprocess.hpp
+//  DigitScanner
+//
+//  Turns a digit region of the warped page into the 28x28
+//  binary tensor both classifiers expect.
+//
+
+#ifndef DigitPreprocess_hpp
+#define DigitPreprocess_hpp
+
+#include "Contour.hpp"
+#include <vector>
+
+using namespace std;
+using namespace cimg_library;
+using namespace ct;
+
+const int DIGIT_SIZE = 28;
+
+class DigitPreprocessor
+{
+public:
+
+    /**
+     *  process():
+     *  Crop, binarize on luma (< 128 is ink), pad with background,
+     *  resize to DIGIT_SIZE x DIGIT_SIZE and rebinarize at 0.65,
+     *  reading the 8 bit page directly.
+     *  Gives the same result as cropping, RGBtoYCbCr, threshold,
+     *  negate, pad, resize(28, 28, 1, 1, 3) and threshold in CImg.
+     *  @param
+     *  image: RGB or gray page
+     *  region: crop rect, parts outside the page count as background
+     *  padding: background border added around the crop
+     *  out: DIGIT_SIZE * DIGIT_SIZE floats, row major, 0 or 1
+     */
+    void process(const CImg<unsigned char>& image, const Rect& region, int padding, float* out);
+
+    /**
+     *  process():
+     *  Same, resampled to out_w x out_h instead, e.g. a whole text
+     *  line scaled so its digits come out at about DIGIT_SIZE.
+     *  @param
+     *  out: out_w * out_h floats, row major, 0 or 1
+     */
+    void process(const CImg<unsigned char>& image, const Rect& region, int padding,
+                 int out_w, int out_h, float* out);
+
+private:
+
+    //Contribution of source index src to one output index.
+    struct Tap
+    {
+        int src;
+        float weight;
+    };
+
+    //Resampling table for one axis: taps of output i are
+    //taps[begin[i]] .. taps[begin[i+1]-1], their sum divided by norm.
+    struct AxisTable
+    {
+        int size;
+        int dst_size;
+        vector<int> begin;
+        vector<Tap> taps;
+        float norm;
+    };
+
+    void buildTable(AxisTable& table, int src_size, int dst_size);
+
+    AxisTable xTable, yTable;
+
+    //Ink mask of the padded crop, and its rows resampled in x.
+    vector<unsigned char> ink;
+    vector<float> rows;
+};
+
+#endif /* DigitPreprocess_hpp */
@@ -0,0 +1,353 @@
+//
+//  FFTConv.cpp
+//  DigitScanner
+//
+
+#include "headers.h"
+#include "FFTConv.hpp"
+#include <algorithm>
+#include <string.h>
+#include <math.h>
+
+//Smallest 2^a 3^b >= size
+static int fft_size(int size) {
+    for (int s = std::max(size, 1); ; s++) {
+        int r = s;
+        while (r % 2 == 0) r /= 2;
+        while (r % 3 == 0) r /= 3;
+        if (r == 1) {
+            return s;
+        }
+    }
+}
+
+FFTConv::FFTConv() {
+    n = kh = kw = in = out = h = w = 0;
+}
+
+void FFTConv::plan(int size) {
+
+    n = size;
+    stages.clear();
+
+    //Radix 4 first keeps the pass count down, 36 = 4 * 3 * 3
+    int len = n;
+    const int radices[] = { 4, 2, 3 };
+    for (int i = 0; i < 3; i++) {
+        const int p = radices[i];
+        while (len % p == 0) {
+            Stage st;
+            st.p = p;
+            st.m = len / p;
+            st.tw_re.resize(st.m * p);
+            st.tw_im.resize(st.m * p);
+            for (int k = 0; k < st.m; k++) {
+                for (int u = 0; u < p; u++) {
+                    const double a = -2 * M_PI * k * u / len;
+                    st.tw_re[k * p + u] = (float)cos(a);
+                    st.tw_im[k * p + u] = (float)sin(a);
+                }
+            }
+            stages.push_back(st);
+            len /= p;
+        }
+    }
+
+}
+
+typedef Eigen::Map<Eigen::ArrayXf> MapArray;
+typedef Eigen::Map<const Eigen::ArrayXf> ConstMapArray;
+
+//Complex multiply of count lines by one twiddle
+template <typename Re, typename Im>
+static inline void twiddle(const Re& xr, const Im& xi, float wr, float wi, float* br, float* bi, int count) {
+    MapArray(br, count) = xr * wr - xi * wi;
+    MapArray(bi, count) = xr * wi + xi * wr;
+}
+
+//Butterflies of one pass over count lines, b_u = sum_r a_r exp(-2 pi i r u / p)
+//times the twiddle w_u. Inputs are ar + r * in_step, outputs br + u * out_step.
+static void radix2(int count, const float* ar, const float* ai, size_t in_step,
+                   float* br, float* bi, size_t out_step, const float* wr, const float* wi) {
+
+    ConstMapArray a0r(ar, count), a0i(ai, count);
+    ConstMapArray a1r(ar + in_step, count), a1i(ai + in_step, count);
+    MapArray(br, count) = a0r + a1r;
+    MapArray(bi, count) = a0i + a1i;
+    twiddle(a0r - a1r, a0i - a1i, wr[1], wi[1], br + out_step, bi + out_step, count);
+}
+
+static void radix3(int count, const float* ar, const float* ai, size_t in_step,
+                   float* br, float* bi, size_t out_step, const float* wr, const float* wi) {
+
+    const float half_sqrt3 = 0.86602540378f;
+    ConstMapArray a0r(ar, count), a0i(ai, count);
+    ConstMapArray a1r(ar + in_step, count), a1i(ai + in_step, count);
+    ConstMapArray a2r(ar + 2 * in_step, count), a2i(ai + 2 * in_step, count);
+    MapArray(br, count) = a0r + a1r + a2r;
+    MapArray(bi, count) = a0i + a1i + a2i;
+    //b1 = c - i d, b2 = c + i d with c = a0 - (a1 + a2) / 2, d = (a1 - a2) sqrt(3) / 2
+    twiddle(a0r - 0.5f * (a1r + a2r) + half_sqrt3 * (a1i - a2i),
+            a0i - 0.5f * (a1i + a2i) - half_sqrt3 * (a1r - a2r),
+            wr[1], wi[1], br + out_step, bi + out_step, count);
+    twiddle(a0r - 0.5f * (a1r + a2r) - half_sqrt3 * (a1i - a2i),
+            a0i - 0.5f * (a1i + a2i) + half_sqrt3 * (a1r - a2r),
+            wr[2], wi[2], br + 2 * out_step, bi + 2 * out_step, count);
+}
+
+static void radix4(int count, const float* ar, const float* ai, size_t in_step,
+                   float* br, float* bi, size_t out_step, const float* wr, const float* wi) {
+
+    ConstMapArray a0r(ar, count), a0i(ai, count);
+    ConstMapArray a1r(ar + in_step, count), a1i(ai + in_step, count);
+    ConstMapArray a2r(ar + 2 * in_step, count), a2i(ai + 2 * in_step, count);
+    ConstMapArray a3r(ar + 3 * in_step, count), a3i(ai + 3 * in_step, count);
+    MapArray(br, count) = (a0r + a2r) + (a1r + a3r);
+    MapArray(bi, count) = (a0i + a2i) + (a1i + a3i);
+    //b1 = t1 - i t3, b2 = t0 - t2, b3 = t1 + i t3
+    //with t0 = a0 + a2, t1 = a0 - a2, t2 = a1 + a3, t3 = a1 - a3
+    twiddle((a0r - a2r) + (a1i - a3i), (a0i - a2i) - (a1r - a3r),
+            wr[1], wi[1], br + out_step, bi + out_step, count);
+    twiddle((a0r + a2r) - (a1r + a3r), (a0i + a2i) - (a1i + a3i),
+            wr[2], wi[2], br + 2 * out_step, bi + 2 * out_step, count);
+    twiddle((a0r - a2r) - (a1i - a3i), (a0i - a2i) + (a1r - a3r),
+            wr[3], wi[3], br + 3 * out_step, bi + 3 * out_step, count);
+}
+
+void FFTConv::fft_lines(float* re, float* im, int count) {
+
+    //Decimation in frequency, output in natural order after the last pass.
+    //Element e of every line is the row at offset e * count.
+    const size_t size = (size_t)n * count;
+    work_re.resize(size);
+    work_im.resize(size);
+
+    float* xr = re; float* xi = im;
+    float* yr = work_re.data(); float* yi = work_im.data();
+    int s = 1;
+
+    for (size_t st = 0; st < stages.size(); st++) {
+        const Stage& stage = stages[st];
+        const int p = stage.p;
+        const int m = stage.m;
+        const size_t in_step = (size_t)s * m * count;
+        const size_t out_step = (size_t)s * count;
+
+        for (int k = 0; k < m; k++) {
+            const float* wr = &stage.tw_re[k * p];
+            const float* wi = &stage.tw_im[k * p];
+            for (int q = 0; q < s; q++) {
+                const size_t src = (size_t)(q + s * k) * count;
+                const size_t dst = (size_t)(q + s * p * k) * count;
+                if (p == 2)
+                    radix2(count, xr + src, xi + src, in_step, yr + dst, yi + dst, out_step, wr, wi);
+                else if (p == 3)
+                    radix3(count, xr + src, xi + src, in_step, yr + dst, yi + dst, out_step, wr, wi);
+                else
+                    radix4(count, xr + src, xi + src, in_step, yr + dst, yi + dst, out_step, wr, wi);
+            }
+        }
+
+        std::swap(xr, yr);
+        std::swap(xi, yi);
+        s *= p;
+    }
+
+    if (xr != re) {
+        memcpy(re, xr, size * sizeof(float));
+        memcpy(im, xi, size * sizeof(float));
+    }
+}
+
+void FFTConv::forward(int planes, int cols) {
+
+    //Along y for the non zero columns, then along x after a transpose
+    fft_lines(plane_re.data(), plane_im.data(), planes * cols);
+
+    const size_t row = (size_t)planes * n;
+    trans_re.assign(n * row, 0.f);
+    trans_im.assign(n * row, 0.f);
+    for (int u = 0; u < n; u++) {
+        for (int pl = 0; pl < planes; pl++) {
+            const size_t src = ((size_t)u * planes + pl) * cols;
+            for (int x = 0; x < cols; x++) {
+                trans_re[x * row + (size_t)pl * n + u] = plane_re[src + x];
+                trans_im[x * row + (size_t)pl * n + u] = plane_im[src + x];
+            }
+        }
+    }
+
+    fft_lines(trans_re.data(), trans_im.data(), planes * n);
+}
+
+void FFTConv::init(const float* kernel, int kh, int kw, int in, int out, int h, int w) {
+
+    this->kh = kh; this->kw = kw;
+    this->in = in; this->out = out;
+    this->h = h; this->w = w;
+
+    //Wrapped taps must land in the zero padding: output y reads input
+    //rows y - pad_t ... y - pad_t + kh - 1, and only rows < h are non zero.
+    const int pad_t = (kh - 1) / 2;
+    const int pad_l = (kw - 1) / 2;
+    const int need = std::max(std::max(h + pad_t, h + kh - 1 - pad_t),
+                              std::max(w + pad_l, w + kw - 1 - pad_l));
+    plan(fft_size(need));
+
+    //Correlation is convolution with the kernel flipped around the pad
+    //offset, g[(pad_t - i) mod n][(pad_l - j) mod n] = k[i][j].
+    //The inverse is done as a forward transform, scale by 1 / n^2 here.
+    const size_t nn = (size_t)n * n;
+    const float scale = 1.f / nn;
+    kernel_re.resize(nn * in * out);
+    kernel_im.resize(nn * in * out);
+    for (int c = 0; c < in; c++) {
+        for (int o = 0; o < out; o++) {
+            plane_re.assign(nn, 0.f);
+            plane_im.assign(nn, 0.f);
+            for (int i = 0; i < kh; i++) {
+                for (int j = 0; j < kw; j++) {
+                    const int u = ((pad_t - i) % n + n) % n;
+                    const int v = ((pad_l - j) % n + n) % n;
+                    plane_re[(size_t)u * n + v] = kernel[((size_t)(i * kw + j) * in + c) * out + o] * scale;
+                }
+            }
+            forward(1, n);
+            const size_t dst = ((size_t)c * out + o) * nn;
+            std::copy(trans_re.begin(), trans_re.end(), kernel_re.begin() + dst);
+            std::copy(trans_im.begin(), trans_im.end(), kernel_im.begin() + dst);
+        }
+    }
+
+    input_re.resize(nn * in);
+    input_im.resize(nn * in);
+    output_re.resize(nn * out);
+    output_im.resize(nn * out);
+}
+
+void FFTConv::run(const float* input, float* output) {
+
+    const size_t nn = (size_t)n * n;
+
+    //Two real channels per plane, all planes side by side: [y][pair][x]
+    const int in_pairs = (in + 1) / 2;
+    const size_t in_row = (size_t)in_pairs * w;
+    plane_re.assign(n * in_row, 0.f);
+    plane_im.assign(n * in_row, 0.f);
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            const float* px = input + ((size_t)y * w + x) * in;
+            float* dr = &plane_re[y * in_row + x];
+            float* di = &plane_im[y * in_row + x];
+            for (int c = 0; c < in; c++) {
+                if (c & 1)
+                    di[(c / 2) * w] = px[c];
+                else
+                    dr[(c / 2) * w] = px[c];
+            }
+        }
+    }
+    forward(in_pairs, w);
+
+    //Split the pairs with the Hermitian symmetry,
+    //X_a[k] = (Z[k] + conj Z[-k]) / 2, X_b[k] = (Z[k] - conj Z[-k]) / 2i
+    const size_t spec_row = (size_t)in_pairs * n;
+    for (int pr = 0; pr < in_pairs; pr++) {
+        const int c = 2 * pr;
+        const bool pair = c + 1 < in;
+        float* ar = &input_re[(size_t)c * nn];
+        float* ai = &input_im[(size_t)c * nn];
+        for (int v = 0; v < n; v++) {
+            const float* zr = &trans_re[v * spec_row + (size_t)pr * n];
+            const float* zi = &trans_im[v * spec_row + (size_t)pr * n];
+            const float* nzr = &trans_re[((n - v) % n) * spec_row + (size_t)pr * n];
+            const float* nzi = &trans_im[((n - v) % n) * spec_row + (size_t)pr * n];
+            for (int u = 0; u < n; u++) {
+                const size_t b = (size_t)v * n + u;
+                const int nu = (n - u) % n;
+                ar[b] = (zr[u] + nzr[nu]) * 0.5f;
+                ai[b] = (zi[u] - nzi[nu]) * 0.5f;
+                if (pair) {
+                    ar[b + nn] = (zi[u] + nzi[nu]) * 0.5f;
+                    ai[b + nn] = (nzr[nu] - zr[u]) * 0.5f;
+                }
+            }
+        }
+    }
+
+    //Channel mixing, a complex multiply accumulate per frequency
+    for (int o = 0; o < out; o++) {
+        MapArray yr(&output_re[(size_t)o * nn], nn);
+        MapArray yi(&output_im[(size_t)o * nn], nn);
+        yr.setZero();
+        yi.setZero();
+        for (int c = 0; c < in; c++) {
+            ConstMapArray xr(&input_re[(size_t)c * nn], nn);
+            ConstMapArray xi(&input_im[(size_t)c * nn], nn);
+            ConstMapArray kr(&kernel_re[((size_t)c * out + o) * nn], nn);
+            ConstMapArray ki(&kernel_im[((size_t)c * out + o) * nn], nn);
+            yr += xr * kr - xi * ki;
+            yi += xr * ki + xi * kr;
+        }
+    }
+
+    //Inverse of Y_a + i Y_b as conj(fft(conj(.))): a is the real part,
+    //b the imaginary part. Planes side by side again, [v][pair][u].
+    const int out_pairs = (out + 1) / 2;
+    const size_t out_row = (size_t)out_pairs * n;
+    trans_re.resize(n * out_row);
+    trans_im.resize(n * out_row);
+    for (int pr = 0; pr < out_pairs; pr++) {
+        const int o = 2 * pr;
+        const bool pair = o + 1 < out;
+        const float* ar = &output_re[(size_t)o * nn];
+        const float* ai = &output_im[(size_t)o * nn];
+        for (int v = 0; v < n; v++) {
+            MapArray dr(&trans_re[v * out_row + (size_t)pr * n], n);
+            MapArray di(&trans_im[v * out_row + (size_t)pr * n], n);
+            ConstMapArray yar(ar + (size_t)v * n, n), yai(ai + (size_t)v * n, n);
+            if (pair) {
+                ConstMapArray ybr(ar + nn + (size_t)v * n, n), ybi(ai + nn + (size_t)v * n, n);
+                dr = yar - ybi;
+                di = -yai - ybr;
+            }
+            else {
+                dr = yar;
+                di = -yai;
+            }
+        }
+    }
+    fft_lines(trans_re.data(), trans_im.data(), out_pairs * n);
+
+    //Back to [u][pair][x] for the w columns read back, then along u
+    const size_t back_row = (size_t)out_pairs * w;
+    plane_re.resize(n * back_row);
+    plane_im.resize(n * back_row);
+    for (int u = 0; u < n; u++) {
+        float* dr = &plane_re[u * back_row];
+        float* di = &plane_im[u * back_row];
+        for (int pr = 0; pr < out_pairs; pr++) {
+            const size_t src = (size_t)pr * n + u;
+            for (int x = 0; x < w; x++) {
+                dr[pr * w + x] = trans_re[x * out_row + src];
+                di[pr * w + x] = trans_im[x * out_row + src];
+            }
+        }
+    }
+    fft_lines(plane_re.data(), plane_im.data(), out_pairs * w);
+
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            float* px = output + ((size_t)y * w + x) * out;
+            const float* sr = &plane_re[y * back_row + x];
+            const float* si = &plane_im[y * back_row + x];
+            for (int pr = 0; pr < out / 2; pr++) {
+                px[2 * pr] = sr[pr * w];
+                px[2 * pr + 1] = -si[pr * w];
+            }
+            if (out & 1) {
+                px[out - 1] = sr[(out / 2) * w];
+            }
+        }
+    }
+}
@@ -0,0 +1,86 @@
+//
+//  FFTConv.hpp
+//  DigitScanner
+//
+//  Same padded, stride 1 convolution (TF cross correlation) through
+//  2D FFTs, for layers whose kernels are large compared to the map,
+//  like the 14x14 conv1 on 28x28 digits.
+//
+//  The transform size is the smallest 2^a 3^b that keeps the circular
+//  wrap out of the output window, 36 for conv1. Kernel spectra are
+//  computed once in init(). Pairs of real input channels share one
+//  complex forward transform, pairs of output channels one inverse.
+//  Real and imaginary parts are kept apart and all planes of a layer
+//  are transformed side by side, so every pass runs long vector loops.
+//
+
+#ifndef FFTConv_hpp
+#define FFTConv_hpp
+
+#include <vector>
+
+class FFTConv {
+
+public:
+
+    FFTConv();
+
+    /**
+     *  init():
+     *  Plan the transform and cache the kernel spectra.
+     *  @param
+     *  kernel: kh x kw x in x out (TF HWIO)
+     *  h, w: size of the input and output maps
+     */
+    void init(const float* kernel, int kh, int kw, int in, int out, int h, int w);
+
+    /**
+     *  run():
+     *  Convolve one map, without bias.
+     *  @param
+     *  input: h x w x in
+     *  output: h x w x out
+     */
+    void run(const float* input, float* output);
+
+    //Transform size, 0 before init()
+    int size() const { return n; }
+
+    //run() only handles the map size given to init()
+    bool planned_for(int map_h, int map_w) const { return n && map_h == h && map_w == w; }
+
+private:
+
+    //One radix 2, 3 or 4 pass of the self sorting (Stockham) FFT
+    struct Stage {
+        int p;
+        int m;                          //length of the sub transforms after this pass
+        std::vector<float> tw_re, tw_im;    //m x p, exp(-2 pi i k u / (m p))
+    };
+
+    int n, kh, kw, in, out, h, w;
+    std::vector<Stage> stages;
+
+    //Spectra, n x n planes transposed ([v][u]), real and imaginary apart
+    std::vector<float> kernel_re, kernel_im;    //in x out planes, scaled by 1 / n^2
+    std::vector<float> input_re, input_im;      //in planes
+    std::vector<float> output_re, output_im;    //out planes
+
+    //Scratch, so run() is not reentrant
+    std::vector<float> plane_re, plane_im;  //spatial side, [y][plane][x]
+    std::vector<float> trans_re, trans_im;  //frequency side, [v][plane][u]
+    std::vector<float> work_re, work_im;
+
+    void plan(int size);
+
+    //Forward transforms along the first axis of an n x count block,
+    //in place: line b is re[b], re[b + count], re[b + 2 count], ...
+    void fft_lines(float* re, float* im, int count);
+
+    //Forward 2D transforms of planes side by side in plane_*, [y][plane][x]
+    //with cols columns each, into trans_* as [v][plane][u].
+    //Rows and columns past the map must be zero.
+    void forward(int planes, int cols);
+};
+
+#endif /* FFTConv_hpp */
@@ -6,6 +6,7 @@
 
 #include "headers.h"
 #include "Hough_transform.h"
+#include "Scheduler.hpp"
 #include <float.h>
 
 using namespace cimg_library;
@@ -74,13 +75,11 @@ CImg<unsigned char> Hough_transform::process(int vt, float tf, int ft) {
 
 	toHoughSpace();
 
-	if (debug_disp)
-		hough_space.display();
+	DisplayPolicy(debug_disp).display(hough_space);
 
     thresholdInHough();
 
-    if (debug_disp)
-        threshold_hough.display();
+    DisplayPolicy(debug_disp).display(threshold_hough);
     
     kMeansFiltering();
 
@@ -100,8 +99,7 @@ CImg<unsigned char> Hough_transform::process(int vt, float tf, int ft) {
 		int x = intersects[i].x, y = intersects[i].y;
 		plotPoint(x, y, result);
 	}
-    if (debug_disp)
-        result.display();
+    DisplayPolicy(debug_disp).display(result);
     
 	return result;
 
@@ -115,27 +113,30 @@ void Hough_transform::toHoughSpace() {
 
 	hough_space.assign(thAxis, 2 * pmax, 1, 1, 0);
 
+	vector<point> voters;
 	cimg_forXY(cny, x, y) {
+		if (cny(x, y) > voting_thres)
+			voters.push_back(point(x, y));
+	}
 
-		int v = cny(x, y);
+	//Every angle owns its accumulator column, so angles vote in parallel
+	parallel_for(0, thAxis, 4, [&](int th0, int th1) {
+		for (int th = th0; th < th1; th++) {
 
-		if (v > voting_thres) {
-			// printf("x, y: %d %d\n", x, y);
-			for (int th = 0; th < thAxis; th++) {
+			float angle = (cimg::PI) * th / thAxis;
+			float c = cos(angle), s = sin(angle);
 
-				float angle = (cimg::PI) * th / thAxis;
-				float xcos = x * cos(angle);
-				float ysin = y * sin(angle);
+			for (const point& p : voters) {
+				float xcos = p.x * c;
+				float ysin = p.y * s;
 				float rho = xcos + ysin;
 				
 				float rho_s = rho + pmax;
 
 				hough_space(th, int(rho_s))++;
-
 			}
-
 		}
-	}
+	});
 
 }
 
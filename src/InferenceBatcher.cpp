@@ -0,0 +1,138 @@
+//
+//  InferenceBatcher.cpp
+//  DigitScanner
+//
+
+#include "InferenceBatcher.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+InferenceBatcher::InferenceBatcher(Runner run, int input_len, int max_batch, int max_wait_us)
+    : run(run), input_len(input_len), batch_limit(std::max(max_batch, 1)),
+      max_wait(std::max(max_wait_us, 0)), pending_inputs(0), stopping(false), wait_sum_ms(0) {
+
+    totals.runs = totals.requests = totals.inputs = totals.full_runs = 0;
+    totals.mean_fill = totals.mean_wait_ms = totals.max_wait_ms = 0;
+    dispatcher = std::thread(&InferenceBatcher::dispatch, this);
+}
+
+InferenceBatcher::~InferenceBatcher() {
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    arrived.notify_all();
+    dispatcher.join();
+}
+
+std::future<std::vector<int> > InferenceBatcher::submit(const float* input, int n) {
+
+    std::unique_ptr<Request> request(new Request());
+    request->input = input;
+    request->n = n;
+    request->queued = Clock::now();
+    std::future<std::vector<int> > result = request->result.get_future();
+    if (n <= 0) {
+        request->result.set_value(std::vector<int>());
+        return result;
+    }
+
+    bool wake;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        pending_inputs += n;
+        pending.push_back(std::move(request));
+        //The dispatcher only needs waking for the first request or a full batch
+        wake = pending.size() == 1 || pending_inputs >= batch_limit;
+    }
+    if (wake)
+        arrived.notify_one();
+    return result;
+}
+
+InferenceBatcher::Stats InferenceBatcher::stats() const {
+
+    std::lock_guard<std::mutex> guard(lock);
+    Stats s = totals;
+    if (s.runs > 0) {
+        s.mean_fill = (double)s.inputs / s.runs / batch_limit;
+        s.mean_wait_ms = wait_sum_ms / s.requests;
+    }
+    return s;
+}
+
+void InferenceBatcher::dispatch() {
+
+    std::vector<std::unique_ptr<Request> > taken;
+    std::unique_lock<std::mutex> guard(lock);
+    for (;;) {
+        while (pending.empty() && !stopping) {
+            arrived.wait(guard);
+        }
+        if (pending.empty())
+            return;
+
+        //Wait for company until the oldest request has waited max_wait
+        const Clock::time_point deadline = pending.front()->queued + max_wait;
+        while (pending_inputs < batch_limit && !stopping) {
+            if (arrived.wait_until(guard, deadline) == std::cv_status::timeout)
+                break;
+        }
+
+        //Whole requests in arrival order, at least one
+        int n = 0;
+        taken.clear();
+        while (!pending.empty() && (taken.empty() || n + pending.front()->n <= batch_limit)) {
+            n += pending.front()->n;
+            taken.push_back(std::move(pending.front()));
+            pending.pop_front();
+        }
+        pending_inputs -= n;
+
+        const Clock::time_point start = Clock::now();
+        totals.runs++;
+        totals.requests += taken.size();
+        totals.inputs += n;
+        totals.full_runs += n >= batch_limit;
+        for (auto& r : taken) {
+            const double ms = std::chrono::duration<double, std::milli>(start - r->queued).count();
+            wait_sum_ms += ms;
+            totals.max_wait_ms = std::max(totals.max_wait_ms, ms);
+        }
+        guard.unlock();
+
+        const float* input = taken[0]->input;
+        if (taken.size() > 1) {
+            batch.resize((size_t)n * input_len);
+            size_t offset = 0;
+            for (auto& r : taken) {
+                memcpy(&batch[offset], r->input, (size_t)r->n * input_len * sizeof(float));
+                offset += (size_t)r->n * input_len;
+            }
+            input = batch.data();
+        }
+
+        //Scatter the labels back, a failed run fails the requests
+        //not answered yet
+        size_t answered = 0;
+        try {
+            std::vector<int> labels = run(input, n);
+            labels.resize(n, -1);
+            int offset = 0;
+            for (auto& r : taken) {
+                r->result.set_value(std::vector<int>(labels.begin() + offset, labels.begin() + offset + r->n));
+                offset += r->n;
+                answered++;
+            }
+        }
+        catch (...) {
+            for (size_t k = answered; k < taken.size(); k++) {
+                taken[k]->result.set_exception(std::current_exception());
+            }
+        }
+        taken.clear();
+        guard.lock();
+    }
+}
@@ -0,0 +1,97 @@
+//
+//  InferenceBatcher.hpp
+//  DigitScanner
+//
+//  Merges classifier inputs of concurrent callers into shared runs.
+//  Pages scanned side by side each bring a few dozen digits, too few
+//  to keep the CNN's GEMMs busy. Callers submit their digits and wait
+//  on a future, and one dispatch thread concatenates whole requests
+//  into a batch. It runs when max_batch inputs are waiting or when the
+//  oldest request has waited max_wait, whichever comes first.
+//
+
+#ifndef InferenceBatcher_hpp
+#define InferenceBatcher_hpp
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+
+class InferenceBatcher {
+
+public:
+
+    //Labels of n inputs of input_len floats each, runs on the dispatch thread only
+    typedef std::function<std::vector<int>(const float* input, int n)> Runner;
+
+    struct Stats {
+        long runs;
+        long requests;
+        long inputs;
+        long full_runs;         //flushed by max_batch, the rest by max_wait
+        double mean_fill;       //inputs per run / max_batch
+        double mean_wait_ms;    //from submit() to the start of its run
+        double max_wait_ms;
+    };
+
+    InferenceBatcher(Runner run, int input_len, int max_batch, int max_wait_us);
+
+    //Runs what is still queued, then stops the dispatch thread
+    ~InferenceBatcher();
+
+    /**
+     *  submit():
+     *  Queue n inputs for the next run. Requests are never split, one
+     *  larger than max_batch runs alone.
+     *  @param
+     *  input: n x input_len floats, read by the dispatch thread, so it
+     *  has to stay valid until the future is ready
+     *  @return
+     *  one label per input
+     */
+    std::future<std::vector<int> > submit(const float* input, int n);
+
+    int max_batch() const { return batch_limit; }
+
+    Stats stats() const;
+
+private:
+
+    typedef std::chrono::steady_clock Clock;
+
+    struct Request {
+        const float* input;
+        int n;
+        Clock::time_point queued;
+        std::promise<std::vector<int> > result;
+    };
+
+    Runner run;
+    int input_len, batch_limit;
+    std::chrono::microseconds max_wait;
+
+    mutable std::mutex lock;
+    std::condition_variable arrived;
+    std::deque<std::unique_ptr<Request> > pending;
+    long pending_inputs;
+    bool stopping;
+
+    Stats totals;
+    double wait_sum_ms;
+
+    std::vector<float> batch;
+    std::thread dispatcher;
+
+    void dispatch();
+
+    InferenceBatcher(const InferenceBatcher&);
+    InferenceBatcher& operator=(const InferenceBatcher&);
+};
+
+#endif /* InferenceBatcher_hpp */
@@ -0,0 +1,107 @@
+//
+//  PCA.cpp
+//  DigitScanner
+//
+
+#include "headers.h"
+#include "PCA.hpp"
+
+#include <stdint.h>
+#include <string.h>
+
+PCA::PCA() {
+    in = out = 0;
+}
+
+bool PCA::fit(const float* input, int n, int dim, int components) {
+
+    out = 0;
+    if (n < 2 || dim <= 0 || components <= 0 || components > dim) {
+        return false;
+    }
+
+    ConstMapMatrixf x(input, n, dim);
+    Eigen::RowVectorXf m = x.colwise().mean();
+
+    //Covariance in double, the eigen solver is sensitive to rounding
+    Eigen::MatrixXd centered = (x.rowwise() - m).cast<double>();
+    Eigen::MatrixXd cov = centered.transpose() * centered / (n - 1);
+    Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> solver(cov);
+    if (solver.info() != Eigen::Success) {
+        return false;
+    }
+
+    //Eigenvalues come in increasing order
+    in = dim;
+    mean.assign(m.data(), m.data() + dim);
+    basis.resize((size_t)dim * components);
+    MapMatrixf b(basis.data(), dim, components);
+    for (int c = 0; c < components; c++) {
+        b.col(c) = solver.eigenvectors().col(dim - 1 - c).cast<float>();
+    }
+    out = components;
+    update_offset();
+    return true;
+}
+
+void PCA::update_offset() {
+
+    offset.resize(out);
+    Eigen::Map<Eigen::RowVectorXf>(offset.data(), out).noalias() =
+        Eigen::Map<const Eigen::RowVectorXf>(mean.data(), in) * ConstMapMatrixf(basis.data(), in, out);
+}
+
+bool PCA::save(const char* path) const {
+
+    if (!ready()) {
+        return false;
+    }
+    std::ofstream ofs(path, std::ofstream::binary);
+    const uint32_t version = 1, dims[2] = { (uint32_t)in, (uint32_t)out };
+    ofs.write("DPCA", 4);
+    ofs.write((const char*)&version, sizeof(version));
+    ofs.write((const char*)dims, sizeof(dims));
+    ofs.write((const char*)mean.data(), mean.size() * sizeof(float));
+    ofs.write((const char*)basis.data(), basis.size() * sizeof(float));
+    return (bool)ofs;
+}
+
+bool PCA::load(const char* path) {
+
+    out = 0;
+    std::ifstream ifs(path, std::ifstream::binary);
+    if (!ifs) {
+        return false;
+    }
+
+    char magic[4];
+    uint32_t version = 0, dims[2] = { 0, 0 };
+    ifs.read(magic, 4);
+    ifs.read((char*)&version, sizeof(version));
+    ifs.read((char*)dims, sizeof(dims));
+    if (!ifs || memcmp(magic, "DPCA", 4) != 0 || version != 1 ||
+        dims[0] == 0 || dims[1] == 0 || dims[1] > dims[0]) {
+        return false;
+    }
+
+    mean.resize(dims[0]);
+    basis.resize((size_t)dims[0] * dims[1]);
+    ifs.read((char*)mean.data(), mean.size() * sizeof(float));
+    ifs.read((char*)basis.data(), basis.size() * sizeof(float));
+    if (!ifs) {
+        return false;
+    }
+
+    in = dims[0];
+    out = dims[1];
+    update_offset();
+    return true;
+}
+
+void PCA::project(const float* input, int n, float* output) const {
+
+    MapMatrixf o(output, n, out);
+    o.noalias() = ConstMapMatrixf(input, n, in) * ConstMapMatrixf(basis.data(), in, out);
+    //Centering folded in after the product: (x - m) B = x B - m B
+    o.rowwise() -= Eigen::Map<const Eigen::RowVectorXf>(offset.data(), out);
+}
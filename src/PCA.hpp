@@ -0,0 +1,65 @@
+//
+//  PCA.hpp
+//  DigitScanner
+//
+//  Linear feature front-end for the SVM classifier: digits are
+//  centered and projected on the top principal components of the
+//  training set, so kernels work on ~50-100 values instead of 784.
+//  Fitted by tools/svm_train_digits and stored next to the model.
+//
+
+#ifndef PCA_hpp
+#define PCA_hpp
+
+#include <vector>
+
+class PCA {
+
+public:
+
+    PCA();
+
+    /**
+     *  fit():
+     *  Principal components of a training set.
+     *  @param
+     *  input: n x dim, row major
+     *  components: output dimension, at most dim
+     */
+    bool fit(const float* input, int n, int dim, int components);
+
+    /**
+     *  save() / load():
+     *  File layout, little endian:
+     *  "DPCA", uint32 version, uint32 input dim, uint32 output dim,
+     *  float32 mean[input dim], float32 basis[input dim x output dim].
+     *  @return
+     *  false if the file cannot be written / is missing or malformed
+     */
+    bool save(const char* path) const;
+    bool load(const char* path);
+
+    /**
+     *  project():
+     *  (input - mean) * basis for a batch.
+     *  @param
+     *  input: n x input_dim(), row major
+     *  output: n x output_dim(), row major
+     */
+    void project(const float* input, int n, float* output) const;
+
+    int input_dim() const { return in; }
+    int output_dim() const { return out; }
+    bool ready() const { return out > 0; }
+
+private:
+
+    int in, out;
+    std::vector<float> mean;    //in
+    std::vector<float> basis;   //in x out, components by decreasing variance
+    std::vector<float> offset;  //mean * basis, subtracted after projecting
+
+    void update_offset();
+};
+
+#endif /* PCA_hpp */
@@ -0,0 +1,386 @@
+//
+//  Pipeline.hpp
+//  DigitScanner
+//
+//  Staged executor for scanning many pages: each stage has its own
+//  workers and pulls jobs from a bounded queue in front of it, so
+//  decoding, geometry and recognition of different pages overlap.
+//
+//  Queues are bounded lock free MPMC rings (Vyukov). Workers only fall
+//  back to a condition variable when their queue is empty or the next
+//  one is full, which is also the backpressure: a slow stage fills its
+//  queue and stalls the ones before it. On top of that at most window
+//  jobs are in flight, which bounds memory and the reorder buffer of
+//  the ordered output mode.
+//
+
+#ifndef Pipeline_hpp
+#define Pipeline_hpp
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <functional>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+
+template <typename T>
+class BoundedQueue {
+
+public:
+
+    //capacity is rounded up to a power of two
+    explicit BoundedQueue(size_t capacity) : closed(false), sleepers(0), head(0), tail(0) {
+        size_t n = 2;
+        while (n < capacity) n *= 2;
+        cells.reset(new Cell[n]);
+        mask = n - 1;
+        for (size_t i = 0; i < n; i++) {
+            cells[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    //Moves item in, false if full
+    bool try_push(T& item) {
+        if (!push_cell(item))
+            return false;
+        wake();
+        return true;
+    }
+
+    //False if empty
+    bool try_pop(T& item) {
+        if (!pop_cell(item))
+            return false;
+        wake();
+        return true;
+    }
+
+    //Blocks while full
+    void push(T item) {
+        if (try_push(item))
+            return;
+        {
+            std::unique_lock<std::mutex> lock(sleep_lock);
+            sleep();
+            while (!push_cell(item)) {
+                wakeup.wait(lock);
+            }
+            sleepers--;
+        }
+        wake();
+    }
+
+    //Blocks while empty, false once closed and drained
+    bool pop(T& item) {
+        if (try_pop(item))
+            return true;
+        bool popped;
+        {
+            std::unique_lock<std::mutex> lock(sleep_lock);
+            sleep();
+            while (!(popped = pop_cell(item)) && !closed) {
+                wakeup.wait(lock);
+            }
+            sleepers--;
+        }
+        if (popped)
+            wake();
+        return popped;
+    }
+
+    //No more pushes, pop() returns false when drained
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(sleep_lock);
+            closed = true;
+        }
+        wakeup.notify_all();
+    }
+
+    //Approximate under concurrent use
+    size_t depth() const {
+        const size_t t = tail.load(std::memory_order_relaxed);
+        const size_t h = head.load(std::memory_order_relaxed);
+        return t > h ? t - h : 0;
+    }
+
+private:
+
+    struct Cell {
+        std::atomic<size_t> seq;
+        T value;
+    };
+
+    std::unique_ptr<Cell[]> cells;
+    size_t mask;
+
+    //Slow path. A waiter registers before its last try and a waker
+    //checks for waiters after its update, with full fences in between,
+    //so one of them always sees the other.
+    std::mutex sleep_lock;
+    std::condition_variable wakeup;
+    bool closed;
+    std::atomic<int> sleepers;
+
+    std::atomic<size_t> head, tail;
+
+    void sleep() {
+        sleepers++;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+
+    //Not under sleep_lock
+    void wake() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (sleepers.load(std::memory_order_relaxed) > 0) {
+            { std::lock_guard<std::mutex> lock(sleep_lock); }
+            wakeup.notify_all();
+        }
+    }
+
+    bool push_cell(T& item) {
+        Cell* c;
+        size_t pos = tail.load(std::memory_order_relaxed);
+        for (;;) {
+            c = &cells[pos & mask];
+            const intptr_t dif = (intptr_t)c->seq.load(std::memory_order_acquire) - (intptr_t)pos;
+            if (dif == 0) {
+                if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (dif < 0)
+                return false;
+            else
+                pos = tail.load(std::memory_order_relaxed);
+        }
+        c->value = std::move(item);
+        c->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop_cell(T& item) {
+        Cell* c;
+        size_t pos = head.load(std::memory_order_relaxed);
+        for (;;) {
+            c = &cells[pos & mask];
+            const intptr_t dif = (intptr_t)c->seq.load(std::memory_order_acquire) - (intptr_t)(pos + 1);
+            if (dif == 0) {
+                if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (dif < 0)
+                return false;
+            else
+                pos = head.load(std::memory_order_relaxed);
+        }
+        item = std::move(c->value);
+        c->seq.store(pos + mask + 1, std::memory_order_release);
+        return true;
+    }
+
+    BoundedQueue(const BoundedQueue&);
+    BoundedQueue& operator=(const BoundedQueue&);
+};
+
+template <typename Job>
+class Pipeline {
+
+public:
+
+    //Returns false or throws when the job failed, later stages then skip it
+    typedef std::function<bool(Job&)> Stage;
+
+    struct StageStats {
+        std::string name;
+        int workers;
+        long jobs;
+        double busy;            //seconds over all workers
+        double mean_depth;      //of the input queue, sampled on every pop
+        size_t max_depth;
+    };
+
+    /**
+     *  Pipeline():
+     *  @param
+     *  queue_capacity: jobs waiting in front of each stage
+     *  window: jobs in flight at once, source blocks beyond that
+     */
+    Pipeline(size_t queue_capacity = 4, size_t window = 32)
+        : queue_capacity(queue_capacity), window(window < 1 ? 1 : window) {}
+
+    void add_stage(const std::string& name, int workers, Stage run) {
+        stages.push_back(std::unique_ptr<StageState>(new StageState(name, workers < 1 ? 1 : workers, run)));
+    }
+
+    /**
+     *  run():
+     *  Feed jobs from source until it returns false. The source runs on
+     *  the calling thread, sink on one thread of its own.
+     *  @param
+     *  sink: called once per job with whether all stages succeeded
+     *  ordered: sink sees jobs in source order, else as they finish
+     */
+    void run(std::function<bool(Job&)> source, std::function<void(Job&, bool)> sink, bool ordered) {
+
+        const size_t count = stages.size();
+        std::vector<std::unique_ptr<BoundedQueue<ItemPtr> > > queues;
+        for (size_t i = 0; i <= count; i++) {
+            queues.push_back(std::unique_ptr<BoundedQueue<ItemPtr> >(new BoundedQueue<ItemPtr>(queue_capacity)));
+        }
+        in_flight = 0;
+
+        std::vector<std::thread> threads;
+        for (size_t s = 0; s < count; s++) {
+            StageState& stage = *stages[s];
+            stage.active = stage.workers;
+            for (int w = 0; w < stage.workers; w++) {
+                threads.push_back(std::thread(&Pipeline::work, this, std::ref(stage),
+                                              std::ref(*queues[s]), std::ref(*queues[s + 1])));
+            }
+        }
+        std::thread output(&Pipeline::drain, this, std::ref(*queues[count]), sink, ordered);
+
+        for (size_t seq = 0; ; seq++) {
+            {
+                std::unique_lock<std::mutex> lock(window_lock);
+                while (in_flight >= window) {
+                    window_free.wait(lock);
+                }
+                in_flight++;
+            }
+            ItemPtr item(new Item(seq));
+            if (!source(item->job)) {
+                release();
+                break;
+            }
+            queues[0]->push(std::move(item));
+        }
+        queues[0]->close();
+
+        for (auto& t : threads) {
+            t.join();
+        }
+        output.join();
+    }
+
+    std::vector<StageStats> stats() const {
+        std::vector<StageStats> result;
+        for (auto& s : stages) {
+            StageStats st;
+            st.name = s->name;
+            st.workers = s->workers;
+            st.jobs = s->jobs;
+            st.busy = s->busy_ns * 1e-9;
+            st.mean_depth = s->depth_samples > 0 ? (double)s->depth_sum / s->depth_samples : 0;
+            st.max_depth = s->max_depth;
+            result.push_back(st);
+        }
+        return result;
+    }
+
+private:
+
+    struct Item {
+        size_t seq;
+        bool ok;
+        Job job;
+        explicit Item(size_t seq) : seq(seq), ok(true) {}
+    };
+    typedef std::unique_ptr<Item> ItemPtr;
+
+    struct StageState {
+        std::string name;
+        int workers;
+        Stage run;
+        std::atomic<int> active;
+        std::atomic<long> jobs;
+        std::atomic<long long> busy_ns;
+        std::atomic<long long> depth_sum, depth_samples;
+        std::atomic<size_t> max_depth;
+
+        StageState(const std::string& name, int workers, Stage run)
+            : name(name), workers(workers), run(run), active(0), jobs(0), busy_ns(0),
+              depth_sum(0), depth_samples(0), max_depth(0) {}
+    };
+
+    size_t queue_capacity, window;
+    std::vector<std::unique_ptr<StageState> > stages;
+
+    std::mutex window_lock;
+    std::condition_variable window_free;
+    size_t in_flight;
+
+    void release() {
+        {
+            std::lock_guard<std::mutex> lock(window_lock);
+            in_flight--;
+        }
+        window_free.notify_one();
+    }
+
+    void work(StageState& stage, BoundedQueue<ItemPtr>& in, BoundedQueue<ItemPtr>& out) {
+
+        ItemPtr item;
+        while (in.pop(item)) {
+            //Depth left behind by this pop
+            const size_t depth = in.depth();
+            stage.depth_sum += depth;
+            stage.depth_samples++;
+            size_t seen = stage.max_depth;
+            while (depth > seen && !stage.max_depth.compare_exchange_weak(seen, depth)) {}
+
+            if (item->ok) {
+                std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+                //A stage that throws fails the job like one returning false
+                try {
+                    item->ok = stage.run(item->job);
+                }
+                catch (...) {
+                    item->ok = false;
+                }
+                stage.busy_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - t0).count();
+                stage.jobs++;
+            }
+            out.push(std::move(item));
+        }
+        //Last worker out closes the next queue
+        if (--stage.active == 0)
+            out.close();
+    }
+
+    void drain(BoundedQueue<ItemPtr>& in, std::function<void(Job&, bool)> sink, bool ordered) {
+
+        //Bounded by the window, a job only waits here for older ones
+        std::map<size_t, ItemPtr> pending;
+        size_t next = 0;
+
+        ItemPtr item;
+        while (in.pop(item)) {
+            if (!ordered) {
+                sink(item->job, item->ok);
+                item.reset();
+                release();
+                continue;
+            }
+            const size_t seq = item->seq;
+            pending[seq] = std::move(item);
+            for (auto it = pending.find(next); it != pending.end(); it = pending.find(++next)) {
+                sink(it->second->job, it->second->ok);
+                pending.erase(it);
+                release();
+            }
+        }
+    }
+
+    Pipeline(const Pipeline&);
+    Pipeline& operator=(const Pipeline&);
+};
+
+#endif /* Pipeline_hpp */
@@ -0,0 +1,160 @@
+//
+//  QGemm.cpp
+//  DigitScanner
+//
+
+#include "QGemm.hpp"
+#include <string.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+void qgemm_pack(const int8_t* B, int n, int k_pad, int8_t* packed)
+{
+    //[n_pad / 8][k_pad / 4][8 columns][4 k]
+    const int blocks = (n + QGEMM_N_ALIGN - 1) / QGEMM_N_ALIGN;
+    for (int jb = 0; jb < blocks; jb++)
+    {
+        int8_t* dst = packed + (long)jb * QGEMM_N_ALIGN * k_pad;
+        for (int p = 0; p < k_pad; p += QGEMM_K_ALIGN)
+        {
+            for (int c = 0; c < QGEMM_N_ALIGN; c++, dst += QGEMM_K_ALIGN)
+            {
+                const int j = jb * QGEMM_N_ALIGN + c;
+                if (j < n)
+                    memcpy(dst, B + (long)j * k_pad + p, QGEMM_K_ALIGN);
+                else
+                    memset(dst, 0, QGEMM_K_ALIGN);
+            }
+        }
+    }
+}
+
+#if defined(__AVX2__)
+
+static inline __m256i dot_u8s8(__m256i acc, __m256i a, __m256i b)
+{
+#if defined(__AVX512VNNI__) && defined(__AVX512VL__)
+    return _mm256_dpbusd_epi32(acc, a, b);
+#elif defined(__AVXVNNI__)
+    return _mm256_dpbusd_avx_epi32(acc, a, b);
+#else
+    //u8 x s8 pairs summed to int16, then pairs of int16 to int32
+    const __m256i pairs = _mm256_maddubs_epi16(a, b);
+    return _mm256_add_epi32(acc, _mm256_madd_epi16(pairs, _mm256_set1_epi16(1)));
+#endif
+}
+
+//MR rows of A against NV blocks of 8 packed columns, all accumulators in registers
+template <int MR, int NV>
+static void kernel(const uint8_t* A, const int8_t* Bp, int k_pad, int32_t* C, int ldc, int n_left)
+{
+    const long block = (long)QGEMM_N_ALIGN * k_pad;
+    __m256i acc[MR][NV];
+    for (int r = 0; r < MR; r++)
+        for (int v = 0; v < NV; v++)
+            acc[r][v] = _mm256_setzero_si256();
+
+    for (int p = 0; p < k_pad; p += QGEMM_K_ALIGN)
+    {
+        __m256i b[NV];
+        for (int v = 0; v < NV; v++)
+            b[v] = _mm256_loadu_si256((const __m256i*)(Bp + v * block + p * QGEMM_N_ALIGN));
+        for (int r = 0; r < MR; r++)
+        {
+            int32_t a4;
+            memcpy(&a4, A + (long)r * k_pad + p, sizeof(a4));
+            const __m256i a = _mm256_set1_epi32(a4);
+            for (int v = 0; v < NV; v++)
+                acc[r][v] = dot_u8s8(acc[r][v], a, b[v]);
+        }
+    }
+
+    for (int v = 0; v < NV; v++)
+    {
+        const int cols = n_left - v * QGEMM_N_ALIGN;
+        const __m256i mask = _mm256_cmpgt_epi32(_mm256_set1_epi32(cols), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+        for (int r = 0; r < MR; r++)
+        {
+            int32_t* c = C + (long)r * ldc + v * QGEMM_N_ALIGN;
+            if (cols >= QGEMM_N_ALIGN)
+                _mm256_storeu_si256((__m256i*)c, acc[r][v]);
+            else
+                _mm256_maskstore_epi32((int*)c, mask, acc[r][v]);
+        }
+    }
+}
+
+template <int MR>
+static void row_block(const uint8_t* A, const int8_t* Bp, int k_pad, int32_t* C, int ldc, int n_left, int nv)
+{
+    switch (nv)
+    {
+        case 3: kernel<MR, 3>(A, Bp, k_pad, C, ldc, n_left); break;
+        case 2: kernel<MR, 2>(A, Bp, k_pad, C, ldc, n_left); break;
+        default: kernel<MR, 1>(A, Bp, k_pad, C, ldc, n_left); break;
+    }
+}
+
+void qgemm_u7s8(const uint8_t* A, const int8_t* packed, int m, int n, int k_pad, int32_t* C)
+{
+    const int blocks = (n + QGEMM_N_ALIGN - 1) / QGEMM_N_ALIGN;
+    for (int i = 0; i < m; i += 4)
+    {
+        const int mr = m - i < 4 ? m - i : 4;
+        const uint8_t* a = A + (long)i * k_pad;
+        for (int jb = 0; jb < blocks; jb += 3)
+        {
+            const int nv = blocks - jb < 3 ? blocks - jb : 3;
+            const int8_t* b = packed + (long)jb * QGEMM_N_ALIGN * k_pad;
+            int32_t* c = C + (long)i * n + jb * QGEMM_N_ALIGN;
+            const int n_left = n - jb * QGEMM_N_ALIGN;
+            switch (mr)
+            {
+                case 4: row_block<4>(a, b, k_pad, c, n, n_left, nv); break;
+                case 3: row_block<3>(a, b, k_pad, c, n, n_left, nv); break;
+                case 2: row_block<2>(a, b, k_pad, c, n, n_left, nv); break;
+                default: row_block<1>(a, b, k_pad, c, n, n_left, nv); break;
+            }
+        }
+    }
+}
+
+const char* qgemm_kernel_name()
+{
+#if defined(__AVX512VNNI__) && defined(__AVX512VL__)
+    return "avx512-vnni";
+#elif defined(__AVXVNNI__)
+    return "avx-vnni";
+#else
+    return "avx2";
+#endif
+}
+
+#else
+
+void qgemm_u7s8(const uint8_t* A, const int8_t* packed, int m, int n, int k_pad, int32_t* C)
+{
+    for (int i = 0; i < m; i++)
+    {
+        const uint8_t* a = A + (long)i * k_pad;
+        int32_t* c = C + (long)i * n;
+        for (int j = 0; j < n; j++)
+        {
+            const int8_t* b = packed + (long)(j / QGEMM_N_ALIGN) * QGEMM_N_ALIGN * k_pad + (j % QGEMM_N_ALIGN) * QGEMM_K_ALIGN;
+            int32_t acc = 0;
+            for (int p = 0; p < k_pad; p += QGEMM_K_ALIGN, b += QGEMM_N_ALIGN * QGEMM_K_ALIGN)
+                for (int t = 0; t < QGEMM_K_ALIGN; t++)
+                    acc += a[p + t] * b[t];
+            c[j] = acc;
+        }
+    }
+}
+
+const char* qgemm_kernel_name()
+{
+    return "portable";
+}
+
+#endif
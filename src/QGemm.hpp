@@ -0,0 +1,63 @@
+//
+//  QGemm.hpp
+//  DigitScanner
+//
+//  Integer GEMM for the int8 CNN path.
+//
+//  Activations are unsigned 7 bit (0-127) and weights signed 8 bit,
+//  so the AVX2 pair products of _mm256_maddubs_epi16 never saturate
+//  int16. Uses AVX-VNNI / AVX512-VNNI dot products when compiled in,
+//  AVX2 otherwise, and a portable loop without either.
+//
+//  Weights are packed so that one 32 byte vector holds 4 consecutive
+//  k of 8 output columns, which is what a u8 x s8 dot product to int32
+//  lanes consumes: 4 broadcast activations against 8 columns at once,
+//  without horizontal sums.
+//
+
+#ifndef QGemm_hpp
+#define QGemm_hpp
+
+#include <stdint.h>
+
+//Rows of A are padded with zeros to a multiple of this
+const int QGEMM_K_ALIGN = 4;
+
+//Columns of packed weights are padded with zeros to a multiple of this
+const int QGEMM_N_ALIGN = 8;
+
+inline int qgemm_pad(int k)
+{
+    return (k + QGEMM_K_ALIGN - 1) / QGEMM_K_ALIGN * QGEMM_K_ALIGN;
+}
+
+//Size of the packed weights for n columns and k_pad rows
+inline int qgemm_packed_size(int n, int k_pad)
+{
+    return (n + QGEMM_N_ALIGN - 1) / QGEMM_N_ALIGN * QGEMM_N_ALIGN * k_pad;
+}
+
+/**
+ *  qgemm_pack():
+ *  Pack weights for qgemm_u7s8.
+ *  @param
+ *  B: n x k_pad, row major, one row per output column
+ *  packed: qgemm_packed_size(n, k_pad) bytes
+ */
+void qgemm_pack(const int8_t* B, int n, int k_pad, int8_t* packed);
+
+/**
+ *  qgemm_u7s8():
+ *  C = A * B^T with int32 accumulation.
+ *  @param
+ *  A: m x k_pad, row major, values 0-127
+ *  packed: B from qgemm_pack()
+ *  C: m x n, row major
+ *  k_pad: row length of A, multiple of QGEMM_K_ALIGN
+ */
+void qgemm_u7s8(const uint8_t* A, const int8_t* packed, int m, int n, int k_pad, int32_t* C);
+
+//Name of the kernel compiled in, for reports
+const char* qgemm_kernel_name();
+
+#endif /* QGemm_hpp */
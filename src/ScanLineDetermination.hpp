@@ -12,7 +12,7 @@
 #include "Contour.hpp"
 #include <vector>
 #include <algorithm>
-#include "CImg.h"
+#include "DebugDisplay.hpp"
 
 using namespace cimg_library;
 using namespace ct;
@@ -41,36 +41,32 @@ public:
     ScanLineDet(int h) : height(h) {}
     
     /**
-     *  getSorted():
+     *  getLines():
      *  From a set of rects generated by contour
-     *  detection, sort the rects by line and
-     *  horizontal position.
+     *  detection, group the rects by scan line and
+     *  sort each line by horizontal position.
+     *  Runs in O(height + n log n).
      */
-    vector<Rect> getSorted(vector<Rect> regions)
+    vector<vector<Rect> > getLines(const vector<Rect>& regions)
     {
-        
-        vector<int> lineRectHist;
-        for (int i = 0; i < height; i++)
-        {
-            int vote = 0;
-            for (auto& r : regions)
-            {
-                if (r.y <= i && r.y + r.height >= i)
-                    vote++;
-            }
-            lineRectHist.push_back(vote);
-        }
-        
-        vector<int> dLineRectHist;
-        dLineRectHist.push_back(-1);
-        for (int i = 1; i < lineRectHist.size(); i++)
+        //Difference array of the line histogram: the vote
+        //count changes by dLineRectHist[i] from row i-1 to row i.
+        vector<int> dLineRectHist(height + 1, 0);
+        for (auto& r : regions)
         {
-            dLineRectHist.push_back(lineRectHist[i] - lineRectHist[i-1]);
+            int top = max(r.y, 0);
+            int bottom = min(r.y + r.height, height - 1);
+            if (top > bottom)
+                continue;
+            dLineRectHist[top]++;
+            dLineRectHist[bottom + 1]--;
         }
+        if (height > 0)
+            dLineRectHist[0] = -1;
         
         vector<int> medPair;
         int lo = -1, hi = -1;
-        for (int i = 0 ; i < dLineRectHist.size(); i++)
+        for (int i = 0 ; i < height; i++)
         {
             
             if (dLineRectHist[i] > 0)
@@ -87,44 +83,57 @@ public:
             }
         }
         
+        //Medians are increasing, so the lines crossing a rect
+        //form a contiguous run found by binary search.
         vector<RectWLine> rectLinePairs;
-        for (int i = 0; i < medPair.size(); i++)
+        for (auto& r : regions)
         {
-            for (int j = 0; j < regions.size(); j++)
+            auto it = lower_bound(medPair.begin(), medPair.end(), r.y);
+            for (; it != medPair.end() && *it <= r.y + r.height; it++)
             {
-                if (regions[j].y <= medPair[i] && regions[j].y + regions[j].height >= medPair[i])
-                {
-                    RectWLine r;
-                    r.line = medPair[i];
-                    r.rect = regions[j];
-                    rectLinePairs.push_back(r);
-                }
+                RectWLine rl;
+                rl.line = (int)(it - medPair.begin());
+                rl.rect = r;
+                rectLinePairs.push_back(rl);
             }
         }
         
         //Sort By Line Num;
         sort(rectLinePairs.begin(), rectLinePairs.end(), rectSort);
         
-        vector<Rect> sorted;
+        vector<vector<Rect> > lines;
         int lastLine = -1;
-        for (auto rlp : rectLinePairs)
+        for (auto& rlp : rectLinePairs)
         {
-            if (lastLine == -1)
+            if (lastLine != rlp.line)
             {
+                lines.push_back(vector<Rect>());
                 lastLine = rlp.line;
             }
-            else
+            lines.back().push_back(rlp.rect);
+        }
+        
+        return lines;
+    }
+    
+    /**
+     *  getSorted():
+     *  Same as getLines(), flattened with a
+     *  (-1, -1, -1, -1) rect between lines.
+     */
+    vector<Rect> getSorted(const vector<Rect>& regions)
+    {
+        vector<vector<Rect> > lines = getLines(regions);
+        
+        vector<Rect> sorted;
+        for (size_t i = 0; i < lines.size(); i++)
+        {
+            if (i > 0)
             {
-                if (lastLine != rlp.line)
-                {
-                    Rect delim(-1, -1, -1, -1);
-                    sorted.push_back(delim);
-                    lastLine = rlp.line;
-                }
-                
+                Rect delim(-1, -1, -1, -1);
+                sorted.push_back(delim);
             }
-            sorted.push_back(rlp.rect);
-            
+            sorted.insert(sorted.end(), lines[i].begin(), lines[i].end());
         }
         
         return sorted;
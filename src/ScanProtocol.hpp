@@ -0,0 +1,138 @@
+//
+//  ScanProtocol.hpp
+//  DigitScanner
+//
+//  Messages between the scan daemon (./scan --serve) and its clients
+//  over a Unix domain socket. Each message, both ways, is a uint32
+//  little endian payload length followed by the payload. A request
+//  payload starts with an op byte:
+//
+//    'P' path      scan the image file at path, as seen by the daemon
+//    'I' bytes     scan an encoded JPEG, PNG, BMP or PNM image
+//    'S' class, uint32 deadline ms, 'P' path | 'I' bytes
+//                  scan as class 'I' (interactive) or 'B' (bulk),
+//                  given up once deadline ms have passed, 0 for the
+//                  class default. 'P' and 'I' alone are interactive.
+//    'H'           health
+//    'T'           stats
+//
+//  A response payload starts with 'K' (ok) or 'E' (error), then text:
+//  the digits in page layout for scans, "key value" lines for health
+//  and stats, the reason for errors. A connection carries any number
+//  of requests, answered in order.
+//
+//  Header only, so clients need nothing else from the scanner.
+//
+
+#ifndef ScanProtocol_hpp
+#define ScanProtocol_hpp
+
+#include <stdint.h>
+#include <string>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+const char SCAN_OP_PATH = 'P';
+const char SCAN_OP_IMAGE = 'I';
+const char SCAN_OP_SCAN = 'S';
+const char SCAN_OP_HEALTH = 'H';
+const char SCAN_OP_STATS = 'T';
+
+const char SCAN_CLASS_INTERACTIVE = 'I';
+const char SCAN_CLASS_BULK = 'B';
+
+const char SCAN_OK = 'K';
+const char SCAN_ERROR = 'E';
+
+//Larger messages are refused and end the connection
+const uint32_t SCAN_MAX_MESSAGE = 64 << 20;
+
+inline bool read_all(int fd, void* data, size_t n) {
+    char* p = (char*)data;
+    while (n > 0) {
+        ssize_t got = read(fd, p, n);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0)
+            return false;
+        p += got;
+        n -= got;
+    }
+    return true;
+}
+
+inline bool write_all(int fd, const void* data, size_t n) {
+    const char* p = (const char*)data;
+    while (n > 0) {
+        ssize_t put = write(fd, p, n);
+        if (put < 0 && errno == EINTR)
+            continue;
+        if (put <= 0)
+            return false;
+        p += put;
+        n -= put;
+    }
+    return true;
+}
+
+/**
+ *  read_message():
+ *  @return
+ *  false on end of stream, error or a message over SCAN_MAX_MESSAGE
+ */
+inline bool read_message(int fd, std::string& payload) {
+    unsigned char len[4];
+    if (!read_all(fd, len, 4))
+        return false;
+    const uint32_t n = len[0] | len[1] << 8 | len[2] << 16 | (uint32_t)len[3] << 24;
+    if (n > SCAN_MAX_MESSAGE)
+        return false;
+    payload.resize(n);
+    return n == 0 || read_all(fd, &payload[0], n);
+}
+
+inline bool write_message(int fd, const std::string& payload) {
+    const uint32_t n = (uint32_t)payload.size();
+    const unsigned char len[4] = { (unsigned char)n, (unsigned char)(n >> 8),
+                                   (unsigned char)(n >> 16), (unsigned char)(n >> 24) };
+    return write_all(fd, len, 4) && write_all(fd, payload.data(), payload.size());
+}
+
+inline bool write_message(int fd, char op, const std::string& body) {
+    return write_message(fd, op + body);
+}
+
+//Payload of an 'S' request, source is SCAN_OP_PATH or SCAN_OP_IMAGE
+inline std::string scan_request(char cls, uint32_t deadline_ms, char source, const std::string& data) {
+    std::string payload(1, SCAN_OP_SCAN);
+    payload += cls;
+    for (int i = 0; i < 4; i++) {
+        payload += (char)(deadline_ms >> (8 * i));
+    }
+    payload += source;
+    return payload + data;
+}
+
+//Connected socket, -1 if nobody listens at path
+inline int connect_socket(const std::string& path) {
+    sockaddr_un addr;
+    if (path.size() >= sizeof(addr.sun_path))
+        return -1;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path.c_str());
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    if (connect(fd, (sockaddr*)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+#endif /* ScanProtocol_hpp */
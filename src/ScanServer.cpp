@@ -0,0 +1,487 @@
+//
+//  ScanServer.cpp
+//  DigitScanner
+//
+
+#include "ScanServer.hpp"
+#include "ScanProtocol.hpp"
+
+#include <algorithm>
+#include <sstream>
+#include <csignal>
+#include <cstdio>
+#include <poll.h>
+
+//Set by SIGINT / SIGTERM, checked by the accept loop
+static volatile sig_atomic_t signalled = 0;
+
+static void on_signal(int) {
+    signalled = 1;
+}
+
+//Image from the bytes of a file, by its magic number
+static bool decode_image(const std::string& data, CImg<unsigned char>& image) {
+
+    if (data.size() < 4)
+        return false;
+    const unsigned char* magic = (const unsigned char*)data.data();
+    FILE* file = fmemopen((void*)data.data(), data.size(), "rb");
+    if (file == NULL)
+        return false;
+    bool ok = true;
+    try {
+        if (magic[0] == 0xFF && magic[1] == 0xD8)
+            image.load_jpeg(file);
+        else if (magic[0] == 0x89 && magic[1] == 'P' && magic[2] == 'N' && magic[3] == 'G')
+            image.load_png(file);
+        else if (magic[0] == 'B' && magic[1] == 'M')
+            image.load_bmp(file);
+        else if (magic[0] == 'P' && magic[1] >= '1' && magic[1] <= '6')
+            image.load_pnm(file);
+        else
+            ok = false;
+    }
+    catch (CImgException&) {
+        ok = false;
+    }
+    fclose(file);
+    return ok && !image.is_empty();
+}
+
+ScanServer::StageQueue::StageQueue() : closed(false), next_seq(0) {
+    std::fill(depths, depths + REQUEST_CLASSES, 0);
+}
+
+bool ScanServer::StageQueue::Key::operator<(const Key& o) const {
+    if (cls != o.cls) return cls < o.cls;
+    if (deadline != o.deadline) return deadline < o.deadline;
+    return seq < o.seq;
+}
+
+void ScanServer::StageQueue::push(JobPtr job) {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        const Key key = { job->cls, job->deadline, next_seq++ };
+        depths[key.cls]++;
+        jobs.insert(std::make_pair(key, std::move(job)));
+    }
+    ready.notify_one();
+}
+
+bool ScanServer::StageQueue::pop(JobPtr& job) {
+    std::unique_lock<std::mutex> guard(lock);
+    while (jobs.empty() && !closed) {
+        ready.wait(guard);
+    }
+    if (jobs.empty())
+        return false;
+    auto first = jobs.begin();
+    job = std::move(first->second);
+    depths[first->first.cls]--;
+    jobs.erase(first);
+    return true;
+}
+
+void ScanServer::StageQueue::close() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        closed = true;
+    }
+    ready.notify_all();
+}
+
+size_t ScanServer::StageQueue::depth(RequestClass cls) const {
+    std::lock_guard<std::mutex> guard(lock);
+    return depths[cls];
+}
+
+static const char* stage_names[SCAN_STAGES] = { "decode", "canny", "hough", "warp", "detect", "recognize" };
+static const char* class_names[REQUEST_CLASSES] = { "interactive", "bulk" };
+
+ServerConfig::ServerConfig() {
+
+    const int workers[SCAN_STAGES] = { 1, 2, 2, 1, 1, 2 };
+    std::copy(workers, workers + SCAN_STAGES, stage_workers);
+
+    //Interactive pages give up after 5 s, bulk pages wait as long as it takes
+    classes[REQUEST_INTERACTIVE].concurrency = 8;
+    classes[REQUEST_INTERACTIVE].queue = 32;
+    classes[REQUEST_INTERACTIVE].deadline_ms = 5000;
+    classes[REQUEST_BULK].concurrency = 4;
+    classes[REQUEST_BULK].queue = 256;
+    classes[REQUEST_BULK].deadline_ms = 0;
+
+    max_connections = 32;
+}
+
+ScanServer::ScanServer(const Scanner& scanner, const ScanParams& params, const ServerConfig& config)
+    : scanner(scanner), params(params), config(config), admission(config.classes), stopping(false),
+      connections_total(0), connections_refused(0), requests(0), errors(0) {
+
+    //No debug windows from worker threads
+    this->params.verbose = false;
+
+    for (int s = 0; s < SCAN_STAGES; s++) {
+        stages.push_back(std::unique_ptr<StageQueue>(new StageQueue()));
+        stage_jobs[s] = 0;
+        stage_busy_ns[s] = 0;
+        this->config.stage_workers[s] = std::max(config.stage_workers[s], 1);
+    }
+    this->config.max_connections = std::max(config.max_connections, 1);
+    for (int c = 0; c < REQUEST_CLASSES; c++) {
+        scans[c] = 0;
+        expired[c] = 0;
+        latency_next[c] = 0;
+        latency_max[c] = 0;
+    }
+}
+
+bool ScanServer::serve(const std::string& socket_path) {
+
+    sockaddr_un addr;
+    if (socket_path.size() >= sizeof(addr.sun_path)) {
+        cout << "Socket path too long: " << socket_path << endl;
+        return false;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path.c_str());
+
+    //A socket file nobody answers on is left over from a crash
+    int probe = connect_socket(socket_path);
+    if (probe >= 0) {
+        close(probe);
+        cout << "Another daemon is listening on " << socket_path << endl;
+        return false;
+    }
+    unlink(socket_path.c_str());
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0 || bind(listener, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(listener, 64) != 0) {
+        cout << "Unable to listen on " << socket_path << ": " << strerror(errno) << endl;
+        if (listener >= 0)
+            close(listener);
+        return false;
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    //A client hanging up mid response must not kill the daemon
+    signal(SIGPIPE, SIG_IGN);
+
+    started = Clock::now();
+    std::vector<std::vector<std::thread> > pools(SCAN_STAGES);
+    for (int s = 0; s < SCAN_STAGES; s++) {
+        for (int i = 0; i < config.stage_workers[s]; i++) {
+            pools[s].push_back(std::thread(&ScanServer::work, this, s));
+        }
+    }
+    cout << "Listening on " << socket_path << endl;
+
+    while (!stopping && !signalled) {
+        pollfd p;
+        p.fd = listener;
+        p.events = POLLIN;
+        p.revents = 0;
+        if (poll(&p, 1, 200) <= 0)
+            continue;
+        int fd = accept(listener, NULL, NULL);
+        if (fd < 0)
+            continue;
+        bool full;
+        {
+            std::lock_guard<std::mutex> lock(connection_lock);
+            full = connections.size() >= (size_t)config.max_connections;
+            if (!full)
+                connections.insert(fd);
+        }
+        if (full) {
+            connections_refused++;
+            write_message(fd, std::string(1, SCAN_ERROR) + "too many connections");
+            close(fd);
+            continue;
+        }
+        connections_total++;
+        std::thread(&ScanServer::serve_connection, this, fd).detach();
+    }
+    stopping = true;
+    close(listener);
+    unlink(socket_path.c_str());
+
+    //Waiting requests are turned away, readers see the end of their
+    //stream once their admitted scan is answered
+    admission.close();
+    {
+        std::unique_lock<std::mutex> lock(connection_lock);
+        for (int fd : connections) {
+            shutdown(fd, SHUT_RD);
+        }
+        while (!connections.empty()) {
+            connection_closed.wait(lock);
+        }
+    }
+    //Stages are empty by now, each closes after the one feeding it
+    for (int s = 0; s < SCAN_STAGES; s++) {
+        stages[s]->close();
+        for (auto& t : pools[s]) {
+            t.join();
+        }
+    }
+    cout << "Stopped after " << scans[REQUEST_INTERACTIVE] + scans[REQUEST_BULK] << " scans" << endl;
+    return true;
+}
+
+void ScanServer::serve_connection(int fd) {
+
+    std::string request;
+    while (read_message(fd, request)) {
+        requests++;
+        if (!write_message(fd, handle(request)))
+            break;
+    }
+
+    std::lock_guard<std::mutex> lock(connection_lock);
+    connections.erase(fd);
+    close(fd);
+    connection_closed.notify_all();
+}
+
+std::string ScanServer::handle(const std::string& request) {
+
+    const char op = request.empty() ? 0 : request[0];
+    RequestClass cls = REQUEST_INTERACTIVE;
+    uint32_t deadline_ms = 0;
+    char source = op;
+    size_t header = 1;
+    switch (op) {
+        case SCAN_OP_HEALTH:
+            return SCAN_OK + health();
+        case SCAN_OP_STATS:
+            return SCAN_OK + stats();
+        case SCAN_OP_PATH:
+        case SCAN_OP_IMAGE:
+            break;
+        case SCAN_OP_SCAN: {
+            header = 7;
+            if (request.size() < header || (request[1] != SCAN_CLASS_INTERACTIVE && request[1] != SCAN_CLASS_BULK) ||
+                (request[6] != SCAN_OP_PATH && request[6] != SCAN_OP_IMAGE)) {
+                errors++;
+                return std::string(1, SCAN_ERROR) + "malformed scan request";
+            }
+            cls = request[1] == SCAN_CLASS_BULK ? REQUEST_BULK : REQUEST_INTERACTIVE;
+            const unsigned char* d = (const unsigned char*)request.data() + 2;
+            deadline_ms = d[0] | d[1] << 8 | d[2] << 16 | (uint32_t)d[3] << 24;
+            source = request[6];
+            break;
+        }
+        default:
+            errors++;
+            return std::string(1, SCAN_ERROR) + "unknown request";
+    }
+
+    JobPtr job(new Job());
+    job->cls = cls;
+    job->source = source;
+    job->data = request.substr(header);
+    job->queued = Clock::now();
+    if (deadline_ms == 0)
+        deadline_ms = admission.limits(cls).deadline_ms;
+    job->deadline = deadline_ms > 0 ? job->queued + std::chrono::milliseconds(deadline_ms) : Clock::time_point::max();
+
+    switch (admission.enter(cls, job->deadline)) {
+        case AdmissionControl::REJECTED:
+            return std::string(1, SCAN_ERROR) + "busy";
+        case AdmissionControl::EXPIRED:
+            return std::string(1, SCAN_ERROR) + "deadline exceeded";
+        case AdmissionControl::ADMITTED:
+            break;
+    }
+
+    const Clock::time_point queued = job->queued;
+    std::future<std::string> reply = job->reply.get_future();
+    stages[0]->push(std::move(job));
+    std::string response = reply.get();
+    admission.leave(cls);
+    record_latency(cls, std::chrono::duration<double, std::milli>(Clock::now() - queued).count());
+    return response;
+}
+
+void ScanServer::work(int stage) {
+
+    JobPtr job;
+    while (stages[stage]->pop(job)) {
+        std::string error;
+        const Clock::time_point t0 = Clock::now();
+        if (t0 >= job->deadline) {
+            expired[job->cls]++;
+            error = "deadline exceeded";
+        }
+        else {
+            const bool ok = run_stage(stage, *job, error);
+            stage_jobs[stage]++;
+            stage_busy_ns[stage] += std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - t0).count();
+            if (ok && stage + 1 < SCAN_STAGES) {
+                stages[stage + 1]->push(std::move(job));
+                continue;
+            }
+            if (ok) {
+                scans[job->cls]++;
+                job->reply.set_value(SCAN_OK + job->scan.text());
+                job.reset();
+                continue;
+            }
+            errors++;
+        }
+        job->reply.set_value(std::string(1, SCAN_ERROR) + error);
+        job.reset();
+    }
+}
+
+bool ScanServer::run_stage(int stage, Job& job, std::string& error) {
+
+    try {
+        switch (stage) {
+            case 0:
+                if (job.source == SCAN_OP_PATH)
+                    job.scan.image.load(job.data.c_str());
+                else if (!decode_image(job.data, job.scan.image))
+                    job.scan.image.assign();
+                job.data.clear();
+                if (job.scan.image.is_empty()) {
+                    error = "unable to read image";
+                    return false;
+                }
+                break;
+            case 1:
+                Scanner::find_edges(job.scan, params);
+                break;
+            case 2:
+                Scanner::find_corners(job.scan, params);
+                break;
+            case 3:
+                if (!Scanner::warp(job.scan, params)) {
+                    error = "no sheet found";
+                    return false;
+                }
+                job.scan.image.assign();
+                break;
+            case 4:
+                Scanner::detect(job.scan, params);
+                break;
+            case 5:
+                scanner.recognize(job.scan, params);
+                if (!job.scan.ok) {
+                    error = "no classifier loaded";
+                    return false;
+                }
+                break;
+        }
+        return true;
+    }
+    catch (CImgException&) {
+        error = stage == 0 ? "unable to read image" : "unable to process image";
+        return false;
+    }
+    catch (std::exception& e) {
+        error = e.what();
+        return false;
+    }
+}
+
+void ScanServer::record_latency(RequestClass cls, double ms) {
+
+    std::lock_guard<std::mutex> lock(latency_lock);
+    std::vector<double>& window = latencies[cls];
+    if (window.size() < LATENCY_WINDOW)
+        window.push_back(ms);
+    else
+        window[latency_next[cls]] = ms;
+    latency_next[cls] = (latency_next[cls] + 1) % LATENCY_WINDOW;
+    latency_max[cls] = std::max(latency_max[cls], ms);
+}
+
+std::string ScanServer::health() const {
+
+    std::ostringstream out;
+    out << "status " << (stopping ? "stopping" : "ok") << endl
+        << "classifier " << (scanner.recognizer().cnn_ready() ? "cnn" : scanner.recognizer().svm_ready() ? "svm" : "none") << endl
+        << "workers";
+    for (int s = 0; s < SCAN_STAGES; s++) {
+        out << " " << config.stage_workers[s];
+    }
+    out << endl;
+    return out.str();
+}
+
+std::string ScanServer::stats() const {
+
+    size_t open;
+    {
+        std::lock_guard<std::mutex> lock(connection_lock);
+        open = connections.size();
+    }
+
+    std::ostringstream out;
+    out << "uptime_s " << std::chrono::duration<double>(Clock::now() - started).count() << endl
+        << "connections " << open << endl
+        << "connections_total " << connections_total << endl
+        << "connections_refused " << connections_refused << endl
+        << "requests " << requests << endl
+        << "errors " << errors << endl;
+
+    for (int c = 0; c < REQUEST_CLASSES; c++) {
+        const RequestClass cls = (RequestClass)c;
+        const AdmissionControl::ClassStats a = admission.stats(cls);
+        std::vector<double> window;
+        double max_ms;
+        {
+            std::lock_guard<std::mutex> lock(latency_lock);
+            window = latencies[c];
+            max_ms = latency_max[c];
+        }
+        double mean = 0, p50 = 0, p99 = 0;
+        if (!window.empty()) {
+            std::sort(window.begin(), window.end());
+            for (double ms : window) mean += ms;
+            mean /= window.size();
+            p50 = window[window.size() / 2];
+            p99 = window[std::min(window.size() - 1, window.size() * 99 / 100)];
+        }
+
+        const std::string name = class_names[c];
+        out << name << "_scans " << scans[c] << endl
+            << name << "_in_flight " << a.in_flight << "/" << admission.limits(cls).concurrency << endl
+            << name << "_waiting " << a.waiting << "/" << admission.limits(cls).queue << endl
+            << name << "_admitted " << a.admitted << endl
+            << name << "_rejected " << a.rejected << endl
+            << name << "_expired " << a.expired + expired[c] << endl
+            //Over the last LATENCY_WINDOW scans, max since start
+            << name << "_latency_mean_ms " << mean << endl
+            << name << "_latency_p50_ms " << p50 << endl
+            << name << "_latency_p99_ms " << p99 << endl
+            << name << "_latency_max_ms " << max_ms << endl;
+    }
+
+    //Pages waiting in front of each stage, interactive then bulk, and
+    //pages run and seconds spent over the stage's workers
+    for (int s = 0; s < SCAN_STAGES; s++) {
+        out << "queue_" << stage_names[s] << " " << stages[s]->depth(REQUEST_INTERACTIVE)
+            << " " << stages[s]->depth(REQUEST_BULK) << endl
+            << "stage_" << stage_names[s] << " " << stage_jobs[s] << " " << stage_busy_ns[s] * 1e-9 << endl;
+    }
+
+    InferenceBatcher::Stats batching;
+    if (scanner.recognizer().batching_stats(batching)) {
+        out << "batch_runs " << batching.runs << endl
+            << "batch_requests " << batching.requests << endl
+            << "batch_digits " << batching.inputs << endl
+            << "batch_full_runs " << batching.full_runs << endl
+            << "batch_fill " << batching.mean_fill << endl
+            << "batch_wait_mean_ms " << batching.mean_wait_ms << endl
+            << "batch_wait_max_ms " << batching.max_wait_ms << endl;
+    }
+    return out.str();
+}
@@ -0,0 +1,172 @@
+//
+//  ScanServer.hpp
+//  DigitScanner
+//
+//  Long running scan daemon: the models stay loaded and pages arrive
+//  over a Unix domain socket (ScanProtocol.hpp), so a request costs
+//  one scan instead of a process start and a model load.
+//
+//  Every connection gets a thread that reads its requests. Health and
+//  stats are answered right there. Scans pass admission control
+//  (Admission.hpp) and then the steps of Scanner::scan() as stages,
+//  each with its own workers and a StageQueue in front. Interactive
+//  pages are taken before any queued bulk page at every stage, and a
+//  page whose deadline has passed is dropped at the next stage instead
+//  of being finished for nobody.
+//
+
+#ifndef ScanServer_hpp
+#define ScanServer_hpp
+
+#include "Scanner.hpp"
+#include "Admission.hpp"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <set>
+#include <map>
+#include <memory>
+#include <future>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+
+//Decode, Canny, Hough, warp, detection, recognition
+const int SCAN_STAGES = 6;
+
+struct ServerConfig {
+
+    //Workers per stage
+    int stage_workers[SCAN_STAGES];
+
+    //Per RequestClass
+    ClassLimits classes[REQUEST_CLASSES];
+
+    //Open connections, each may buffer a request of up to
+    //SCAN_MAX_MESSAGE before admission sees it. Further ones are refused.
+    int max_connections;
+
+    ServerConfig();
+};
+
+class ScanServer {
+
+public:
+
+    /**
+     *  ScanServer():
+     *  @param
+     *  scanner: loaded, shared by all workers
+     */
+    ScanServer(const Scanner& scanner, const ScanParams& params, const ServerConfig& config);
+
+    /**
+     *  serve():
+     *  Listen on socket_path until stop() or SIGINT / SIGTERM, replacing
+     *  a stale socket file. Admitted scans are answered before it
+     *  returns, waiting ones are turned away.
+     *  @return
+     *  false if the socket could not be set up
+     */
+    bool serve(const std::string& socket_path);
+
+    void stop() { stopping = true; }
+
+    //Response bodies of the health and stats requests
+    std::string health() const;
+    std::string stats() const;
+
+private:
+
+    typedef std::chrono::steady_clock Clock;
+
+    struct Job {
+        RequestClass cls;
+        char source;                    //SCAN_OP_PATH or SCAN_OP_IMAGE
+        std::string data;               //path or encoded image
+        Clock::time_point queued, deadline;
+        ScanResult scan;
+        std::promise<std::string> reply;
+    };
+    typedef std::unique_ptr<Job> JobPtr;
+
+    //Unbounded, admission in front of the first stage bounds it. Hands
+    //out the most urgent class first and, within a class, the earliest
+    //deadline.
+    class StageQueue {
+
+    public:
+
+        StageQueue();
+
+        void push(JobPtr job);
+
+        //Blocks while empty, false once closed and drained
+        bool pop(JobPtr& job);
+        void close();
+
+        size_t depth(RequestClass cls) const;
+
+    private:
+
+        struct Key {
+            RequestClass cls;
+            Clock::time_point deadline;
+            uint64_t seq;   //arrival order among equal deadlines
+
+            bool operator<(const Key& o) const;
+        };
+
+        mutable std::mutex lock;
+        std::condition_variable ready;
+        std::map<Key, JobPtr> jobs;
+        bool closed;
+        uint64_t next_seq;
+        size_t depths[REQUEST_CLASSES];
+    };
+
+    const Scanner& scanner;
+    ScanParams params;
+    ServerConfig config;
+
+    AdmissionControl admission;
+    std::vector<std::unique_ptr<StageQueue> > stages;
+    std::atomic<long> stage_jobs[SCAN_STAGES];
+    std::atomic<long long> stage_busy_ns[SCAN_STAGES];
+    std::atomic<bool> stopping;
+    Clock::time_point started;
+
+    //Open connections, shut down on stop so their readers return
+    mutable std::mutex connection_lock;
+    std::condition_variable connection_closed;
+    std::set<int> connections;
+
+    std::atomic<long> connections_total, connections_refused, requests, errors;
+    std::atomic<long> scans[REQUEST_CLASSES], expired[REQUEST_CLASSES];
+
+    //Latency of the last scans of each class, from arrival to the reply
+    static const size_t LATENCY_WINDOW = 1024;
+    mutable std::mutex latency_lock;
+    std::vector<double> latencies[REQUEST_CLASSES];
+    size_t latency_next[REQUEST_CLASSES];
+    double latency_max[REQUEST_CLASSES];
+
+    void work(int stage);
+    void serve_connection(int fd);
+
+    //Response payload for one request payload
+    std::string handle(const std::string& request);
+
+    //One step of the scan, false with error set if the page cannot go on
+    bool run_stage(int stage, Job& job, std::string& error);
+
+    void record_latency(RequestClass cls, double ms);
+
+    ScanServer(const ScanServer&);
+    ScanServer& operator=(const ScanServer&);
+};
+
+#endif /* ScanServer_hpp */
@@ -0,0 +1,158 @@
+//
+//  Scanner.cpp
+//  DigitScanner
+//
+
+#include "Scanner.hpp"
+#include "Canny.h"
+#include "Hough_transform.h"
+#include "Warping.h"
+#include "TextDetection.hpp"
+
+#include <sstream>
+
+ScanParams::ScanParams()
+    : gfs(5), g_sig(3), thres_lo(20), thres_hi(80),
+      voting_thres(64), thres_fac(0.3), filter_thres(200),
+      use_proj_detection(false),
+      use_svm(false), use_line_recognition(false), max_batch(128),
+      verbose(false) {}
+
+ScannerConfig::ScannerConfig(const std::string& model_dir)
+    : cnn_backend(CNN_DEFAULT),
+      cnn_weights(model_dir + "/cnn_weights.bin"),
+      tf_graph(model_dir + "/graph.pb"),
+      tf_checkpoint(model_dir + "/mnist_-94000"),
+      rff_features(0),
+      cascade_margin(4.f),
+      digit_cache_entries(0),
+      batch_digits(0),
+      batch_wait_us(2000) {}
+
+std::string ScanResult::text() const {
+    
+    std::ostringstream out;
+    size_t j = 0;
+    for (auto& r : regions) {
+        if (r.x != -1) {
+            if (j < digits.size())
+                out << digits[j++] << " ";
+        }
+        else
+            out << endl;
+    }
+    return out.str();
+}
+
+void ScanResult::annotate() {
+    
+    size_t j = 0;
+    for (auto& r : regions) {
+        if (r.x == -1 || j >= digits.size())
+            continue;
+        unsigned char color = 1;
+        char b[256];
+        sprintf(b, "%d", digits[j++]);
+        page.draw_text(r.x, r.y, b, &color, 0, 1, 23);
+    }
+}
+
+bool Scanner::load(const ScannerConfig& config) {
+    
+    if (!config.svm_model.empty() || !config.svm_binary.empty()) {
+        if (!text_recognizer.load_svm(config.svm_model, config.svm_binary, config.svm_pca, config.rff_features))
+            return false;
+    }
+    if (!config.cnn_weights.empty() || !config.tf_graph.empty()) {
+        if (!text_recognizer.load_cnn(config.cnn_backend, config.cnn_weights, config.tf_graph, config.tf_checkpoint))
+            return false;
+    }
+    if (!config.cascade_weights.empty()) {
+        if (!text_recognizer.load_cascade(config.cascade_weights, config.cascade_margin))
+            return false;
+    }
+    text_recognizer.init_digit_cache(config.digit_cache_entries);
+    text_recognizer.enable_batching(config.batch_digits, config.batch_wait_us);
+    return true;
+}
+
+ScanResult Scanner::scan(const CImg<unsigned char>& image, const ScanParams& params) const {
+    
+    ScanResult result;
+    result.image = image;
+    find_edges(result, params);
+    find_corners(result, params);
+    if (!warp(result, params)) {
+        result.image.assign();
+        return result;
+    }
+    detect(result, params, DisplayPolicy(params.verbose));
+    recognize(result, params);
+    result.image.assign();
+    return result;
+}
+
+void Scanner::find_edges(ScanResult& result, const ScanParams& params) {
+    
+    CImg<unsigned char>& img = result.image;
+    float resize_fac = img._width / 1000;
+    if (resize_fac == 0) resize_fac = 1;
+    result.resize_fac = resize_fac;
+    
+    CImg<unsigned char> resized(img);
+    resized.resize(img._width / resize_fac, img._height / resize_fac);
+    
+    //Perfrom Canny Edge Detection
+    Canny c(resized);
+    c.verbose = params.verbose;
+    result.edges = c.process(params.gfs, params.g_sig, params.thres_lo, params.thres_hi);
+}
+
+void Scanner::find_corners(ScanResult& result, const ScanParams& params) {
+    
+    //Perform Hough Transform and edge extraction
+    Hough_transform ht(result.image, result.edges, result.resize_fac, params.verbose);
+    ht.process(params.voting_thres, params.thres_fac, params.filter_thres);
+    
+    //Compute Intersects from lines
+    result.corners = ht.getIntersects();
+    result.edges.assign();
+}
+
+bool Scanner::warp(ScanResult& result, const ScanParams& params) {
+    
+    //Warp image to 4 corners
+    Warping warping(result.image, result.corners);
+    warping.verbose = params.verbose;
+    result.warped = warping.processWithProjectionTransform();
+    return !result.warped.is_empty();
+}
+
+void Scanner::detect(ScanResult& result, const ScanParams& params, const DisplayPolicy& disp) {
+    
+    //Split text regions
+    CImg<unsigned char> eroded = result.warped.get_erode(5);
+    result.regions = params.use_proj_detection ?
+        text_projDetection(eroded) :
+        text_contourDetection(eroded, disp);
+    result.page = result.warped.get_erode(3);
+    result.warped.assign();
+}
+
+void Scanner::recognize(ScanResult& result, const ScanParams& params) const {
+    
+    const TextRecognizer& r = text_recognizer;
+    result.ok = params.use_svm ? r.svm_ready() : r.cnn_ready();
+    if (!result.ok) {
+        result.digits.clear();
+        return;
+    }
+    
+    //Regocnize texts
+    if (params.use_svm)
+        result.digits = r.recognize_num(result.page, result.regions);
+    else if (params.use_line_recognition)
+        result.digits = r.tfrecognize_lines(result.page, result.regions);
+    else
+        result.digits = r.tfrecognize_num(result.page, result.regions, params.max_batch);
+}
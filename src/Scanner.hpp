@@ -0,0 +1,147 @@
+//
+//  Scanner.hpp
+//  DigitScanner
+//
+//  Library entry point: a Scanner loads the classifiers once and scans
+//  pages without any global state. Settings come in per call through
+//  ScanParams and every intermediate image lives in the ScanResult of
+//  the call, so one Scanner can serve many threads at once. The steps
+//  of scan() are public too, for callers that schedule them themselves
+//  like the batch pipeline of the scan tool.
+//
+
+#ifndef Scanner_hpp
+#define Scanner_hpp
+
+#include "headers.h"
+#include "TextRecognition.hpp"
+
+#include <string>
+#include <vector>
+
+//Per call settings, the defaults are the ones of the scan tool
+struct ScanParams {
+
+    //Canny
+    int gfs;
+    double g_sig;
+    int thres_lo, thres_hi;
+
+    //Hough
+    int voting_thres;
+    float thres_fac;
+    int filter_thres;
+
+    //Projection profiles instead of connected components, for printed grid forms
+    bool use_proj_detection;
+
+    //SVM instead of the CNN
+    bool use_svm;
+    //Convolve whole text lines once instead of every digit crop (native CNN)
+    bool use_line_recognition;
+    //Digits per CNN run, <= 0 runs the whole page at once
+    int max_batch;
+
+    //Verbose info and debug windows, keep it off when scanning on many threads
+    bool verbose;
+
+    ScanParams();
+};
+
+//Models to load, every path may be left empty to skip that model
+struct ScannerConfig {
+
+    CNNBackend cnn_backend;
+    std::string cnn_weights;                //native backends
+    std::string tf_graph, tf_checkpoint;    //TensorFlow backend
+
+    std::string svm_model, svm_binary, svm_pca;
+    int rff_features;
+
+    std::string cascade_weights;
+    float cascade_margin;
+
+    //Labels of bit identical digits kept across pages, 0 turns it off
+    size_t digit_cache_entries;
+
+    //CNN runs shared by pages recognized at the same time, up to
+    //batch_digits digits after at most batch_wait_us, 0 turns it off
+    int batch_digits;
+    int batch_wait_us;
+
+    //The CNN from model_dir, no SVM, no cascade, no cache and no batching
+    explicit ScannerConfig(const std::string& model_dir = "./model");
+};
+
+//One page on its way through the steps of Scanner::scan()
+struct ScanResult {
+
+    bool ok;
+
+    CImg<unsigned char> image;          //input
+    CImg<unsigned char> edges;          //Canny on the downscaled input
+    float resize_fac;
+    vector<point> corners;              //of the sheet
+    CImg<unsigned char> warped;         //sheet cut out and straightened
+    CImg<unsigned char> page;           //warped, lightly eroded, what recognition reads
+
+    //Rect(-1, -1, -1, -1) separates text lines
+    vector<Rect> regions;
+    //One per region that is not a separator
+    vector<int> digits;
+
+    ScanResult() : ok(false), resize_fac(1) {}
+
+    //Digits space separated, one text line per line
+    std::string text() const;
+
+    //Draws the digits onto page next to their regions
+    void annotate();
+};
+
+class Scanner {
+
+public:
+
+    Scanner() {}
+
+    /**
+     *  load():
+     *  Load the models of config. Not thread safe, finish it before the
+     *  first scan().
+     *  @return
+     *  false if a model failed to load, the reason is printed
+     */
+    bool load(const ScannerConfig& config);
+
+    /**
+     *  scan():
+     *  All steps on one page, may run on many threads at once.
+     *  @return
+     *  the page and its digits, ok is false if no sheet was found or no
+     *  classifier is loaded for params
+     */
+    ScanResult scan(const CImg<unsigned char>& image, const ScanParams& params = ScanParams()) const;
+
+    //The steps of scan() in order, each reads what the ones before it
+    //left in result and frees what no later step needs
+    static void find_edges(ScanResult& result, const ScanParams& params);
+    static void find_corners(ScanResult& result, const ScanParams& params);
+    //False if the corners do not make a quadrilateral, warped is then empty
+    static bool warp(ScanResult& result, const ScanParams& params);
+    static void detect(ScanResult& result, const ScanParams& params,
+                       const DisplayPolicy& disp = DisplayPolicy());
+    void recognize(ScanResult& result, const ScanParams& params) const;
+
+    TextRecognizer& recognizer() { return text_recognizer; }
+    const TextRecognizer& recognizer() const { return text_recognizer; }
+
+private:
+
+    TextRecognizer text_recognizer;
+
+    Scanner(const Scanner&);
+    Scanner& operator=(const Scanner&);
+};
+
+#endif /* Scanner_hpp */
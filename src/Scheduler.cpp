@@ -0,0 +1,212 @@
+//
+//  Scheduler.cpp
+//  DigitScanner
+//
+
+#include "headers.h"
+#include "Scheduler.hpp"
+#include <svm.h>
+
+//Index of the calling thread's queue in its pool, -1 outside
+static thread_local int worker_index = -1;
+static thread_local Scheduler* worker_pool = NULL;
+
+static std::atomic<int> budget(0);
+
+//Yields of an idle TaskGroup::wait() before it sleeps
+static const int WAIT_SPINS = 64;
+
+#if defined(__linux__)
+//OpenBLAS runs its own threads, resolved only when linked against it
+extern "C" void openblas_set_num_threads(int) __attribute__((weak));
+#endif
+
+//libsvm's kernel columns on the shared pool instead of its own
+static void svm_parallel_for(int begin, int end, int grain, void (*body)(void*, int, int), void* ctx) {
+    parallel_for(begin, end, grain, [body, ctx](int b, int e) { body(ctx, b, e); });
+}
+
+void set_thread_budget(int threads) {
+
+    if (threads <= 0)
+        threads = std::max(1, (int)std::thread::hardware_concurrency());
+    budget = threads;
+
+    Eigen::setNbThreads(threads);
+    svm_set_num_threads(threads);
+    svm_set_parallel_for(svm_parallel_for);
+#if defined(__linux__)
+    if (openblas_set_num_threads)
+        openblas_set_num_threads(threads);
+#endif
+}
+
+int thread_budget() {
+    if (budget == 0)
+        set_thread_budget(0);
+    return budget;
+}
+
+Scheduler& Scheduler::instance() {
+    static Scheduler shared(thread_budget());
+    return shared;
+}
+
+Scheduler::Scheduler(int threads) : stop(false), queued(0), idle(0), waiters(0) {
+
+    const int workers = std::max(threads, 1) - 1;
+    for (int i = 0; i <= workers; i++) {
+        queues.push_back(std::unique_ptr<Queue>(new Queue()));
+    }
+    for (int i = 0; i < workers; i++) {
+        pool.push_back(std::thread(&Scheduler::work, this, i));
+    }
+}
+
+Scheduler::~Scheduler() {
+
+    {
+        std::lock_guard<std::mutex> lock(sleep_lock);
+        stop = true;
+    }
+    wakeup.notify_all();
+    for (auto& t : pool) {
+        t.join();
+    }
+}
+
+void Scheduler::submit(Task task) {
+
+    Queue& q = worker_pool == this ? *queues[worker_index] : *queues.back();
+    {
+        std::lock_guard<std::mutex> lock(q.lock);
+        q.tasks.push_back(std::move(task));
+    }
+    queued++;
+    if (idle > 0) {
+        { std::lock_guard<std::mutex> lock(sleep_lock); }
+        wakeup.notify_one();
+    }
+}
+
+bool Scheduler::run_one() {
+
+    const int count = (int)queues.size();
+    const int self = worker_pool == this ? worker_index : count - 1;
+
+    Task task;
+    bool found = false;
+    for (int k = 0; k < count && !found; k++) {
+        Queue& q = *queues[(self + k) % count];
+        std::lock_guard<std::mutex> lock(q.lock);
+        if (q.tasks.empty())
+            continue;
+        //Newest of our own, oldest of anyone else's
+        if (k == 0) {
+            task = std::move(q.tasks.back());
+            q.tasks.pop_back();
+        }
+        else {
+            task = std::move(q.tasks.front());
+            q.tasks.pop_front();
+        }
+        found = true;
+    }
+    if (!found)
+        return false;
+
+    queued--;
+    task.run();
+    //Last task of its group, its waiter may be asleep. Waiters count
+    //themselves before their last look at pending
+    if (task.pending->fetch_sub(1) == 1 && waiters > 0) {
+        { std::lock_guard<std::mutex> lock(sleep_lock); }
+        group_done.notify_all();
+    }
+    return true;
+}
+
+void Scheduler::work(int index) {
+
+    worker_index = index;
+    worker_pool = this;
+
+    while (!stop) {
+        if (run_one())
+            continue;
+
+        //Registered as idle before the last look at queued, and
+        //submit() counts the task before it looks at idle
+        std::unique_lock<std::mutex> lock(sleep_lock);
+        idle++;
+        while (queued == 0 && !stop) {
+            wakeup.wait(lock);
+        }
+        idle--;
+    }
+}
+
+TaskGroup::TaskGroup(Scheduler& scheduler) : scheduler(scheduler), pending(0) {}
+
+TaskGroup::~TaskGroup() {
+    wait();
+}
+
+void TaskGroup::run(std::function<void()> task) {
+
+    pending++;
+    Scheduler::Task t;
+    t.run = std::move(task);
+    t.pending = &pending;
+    scheduler.submit(std::move(t));
+}
+
+void TaskGroup::wait() {
+
+    //Chunks in flight elsewhere are usually about to finish, so spin a
+    //little before sleeping until a task is queued or the group is done
+    int spins = 0;
+    while (pending.load(std::memory_order_acquire) > 0) {
+        if (scheduler.run_one()) {
+            spins = 0;
+            continue;
+        }
+        if (++spins < WAIT_SPINS) {
+            std::this_thread::yield();
+            continue;
+        }
+        //Tasks queued later belong to other groups, the pool runs them
+        std::unique_lock<std::mutex> lock(scheduler.sleep_lock);
+        scheduler.waiters++;
+        while (pending > 0 && scheduler.queued == 0) {
+            scheduler.group_done.wait(lock);
+        }
+        scheduler.waiters--;
+        spins = 0;
+    }
+}
+
+void parallel_for(int begin, int end, int grain, const std::function<void(int, int)>& body) {
+
+    const int n = end - begin;
+    if (n <= 0)
+        return;
+    grain = std::max(grain, 1);
+
+    Scheduler& scheduler = Scheduler::instance();
+    //A few chunks per thread, so stealing can even out uneven rows
+    const int chunks = std::min((n + grain - 1) / grain, scheduler.threads() * 4);
+    if (chunks <= 1) {
+        body(begin, end);
+        return;
+    }
+
+    TaskGroup group(scheduler);
+    for (int c = 1; c < chunks; c++) {
+        const int b = begin + (int)((long)n * c / chunks);
+        const int e = begin + (int)((long)n * (c + 1) / chunks);
+        group.run([&body, b, e] { body(b, e); });
+    }
+    body(begin, begin + (int)((long)n / chunks));
+    group.wait();
+}
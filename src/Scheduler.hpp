@@ -0,0 +1,121 @@
+//
+//  Scheduler.hpp
+//  DigitScanner
+//
+//  One work stealing thread pool for all parallel kernels (Canny,
+//  Hough, warping), so stages running side by side in the pipeline
+//  share the same threads instead of each starting their own.
+//
+//  Every worker owns a deque: it pushes and pops its own tasks at the
+//  back and steals from the front of the others when it runs dry.
+//  Threads outside the pool queue into a shared deque. A thread that
+//  waits for a task group runs queued tasks meanwhile, so nested
+//  parallel_for and calls from pipeline workers cannot deadlock.
+//
+//  set_thread_budget() bounds the pool, hands libsvm's kernel loops to
+//  it and pushes the same budget into BLAS and, at session creation,
+//  TensorFlow's intra and inter op pools.
+//
+
+#ifndef Scheduler_hpp
+#define Scheduler_hpp
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+class Scheduler {
+
+public:
+
+    //Shared pool with thread_budget() threads, created on first use
+    static Scheduler& instance();
+
+    //threads counts the caller of TaskGroup::wait(), so threads - 1 are started
+    explicit Scheduler(int threads);
+    ~Scheduler();
+
+    int threads() const { return (int)pool.size() + 1; }
+
+private:
+
+    friend class TaskGroup;
+
+    struct Task {
+        std::function<void()> run;
+        std::atomic<int>* pending;
+    };
+
+    struct Queue {
+        std::mutex lock;
+        std::deque<Task> tasks;
+    };
+
+    //One per worker, the last one for threads outside the pool
+    std::vector<std::unique_ptr<Queue> > queues;
+    std::vector<std::thread> pool;
+
+    std::atomic<bool> stop;
+    std::atomic<int> queued, idle, waiters;
+    std::mutex sleep_lock;
+    std::condition_variable wakeup;         //idle workers, on submit
+    std::condition_variable group_done;     //sleeping TaskGroup::wait()
+
+    void submit(Task task);
+
+    //Run one task, own queue first, false if none was found
+    bool run_one();
+
+    void work(int index);
+
+    Scheduler(const Scheduler&);
+    Scheduler& operator=(const Scheduler&);
+};
+
+//Tasks that are waited for together
+class TaskGroup {
+
+public:
+
+    explicit TaskGroup(Scheduler& scheduler = Scheduler::instance());
+    ~TaskGroup();
+
+    void run(std::function<void()> task);
+
+    //Returns when all tasks of the group are done, running tasks
+    //meanwhile and sleeping while there are none to run
+    void wait();
+
+private:
+
+    Scheduler& scheduler;
+    std::atomic<int> pending;
+
+    TaskGroup(const TaskGroup&);
+    TaskGroup& operator=(const TaskGroup&);
+};
+
+/**
+ *  parallel_for():
+ *  Split [begin, end) into chunks of at least grain and run body on
+ *  them in the shared pool, the caller included.
+ *  @param
+ *  body: called with a sub range [b, e)
+ */
+void parallel_for(int begin, int end, int grain, const std::function<void(int, int)>& body);
+
+/**
+ *  set_thread_budget():
+ *  Threads for the pool, BLAS, libsvm and TensorFlow sessions created
+ *  afterwards. Call before any parallel work, the pool is only sized
+ *  once. 0 uses all cores.
+ */
+void set_thread_budget(int threads);
+int thread_budget();
+
+#endif /* Scheduler_hpp */
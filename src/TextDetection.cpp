@@ -8,33 +8,19 @@
 
 #include "TextDetection.hpp"
 
-void filterBySize(const CImg<>& image, vector<Rect>& proposals);
+void filterBySize(const CImg<unsigned char>& image, vector<Rect>& proposals);
 
 void filterByAspectRatio(vector<Rect>& p);
 
 void filterByDuplicate(vector<Rect>& p);
 
-void padRegion(const CImg<>& image, vector<Rect>& p, int padding);
+void padRegion(const CImg<unsigned char>& image, vector<Rect>& p, int padding);
 
 struct Block_1D {
     int begin;
     int end;
 };
 
-int argMax(vector<int> v) {
-    if (v.empty()) return -1;
-    int m = v[0];
-    int mi = 0;
-    
-    for (int i = 0; i < v.size(); i++) {
-        if (v[i] > m) {
-            mi = i;
-            m = v[i];
-        }
-    }
-    return mi;
-}
-
 bool rectLRTB(const Rect& a, const Rect& b) {
 //    float same_line_criteria = 10;
 //    if (abs(a.y - b.y) < same_line_criteria) {
@@ -47,10 +33,12 @@ bool rectLRTB(const Rect& a, const Rect& b) {
     return tie(a.y, a.x) < tie(b.y, b.x);
 }
 
-vector<Rect> text_contourDetection(CImg<> image) {
+vector<Rect> text_contourDetection(const CImg<unsigned char>& image, const DisplayPolicy& disp) {
  
-    CImg<float> tempImage = image.get_RGBtoYCbCr().get_channel(0);
-    ct::Contour contours(tempImage);
+    //Luma in float as before, converting the uchar image would round it
+    //to integers before Contour thresholds it
+    CImg<float> tempImage = CImg<float>(image).get_RGBtoYCbCr().get_channel(0);
+    ct::Contour contours(tempImage, disp);
     vector<ct::Rect> proposals = contours.extractRegions();
     
     filterBySize(image, proposals);
@@ -70,12 +58,12 @@ vector<Rect> text_contourDetection(CImg<> image) {
     
     padRegion(image, sorted, 5);
     
-    RectangleAll(image, sorted);
+    RectangleAll(image, sorted, disp);
     
     return sorted;
 }
 
-void filterBySize(const CImg<>& image, vector<Rect>& proposals) {
+void filterBySize(const CImg<unsigned char>& image, vector<Rect>& proposals) {
     
     int size = image._width * image._height;
     float size_thres_lower = 0.0005;
@@ -120,7 +108,7 @@ void filterByDuplicate(vector<Rect>& p) {
         
         size_t count = 0;
         size_t dup_ptr = 0;
-        p.erase(remove_if(p.begin(), p.end(), [&count, &dup_ptr, duplicates](const Rect& r){
+        p.erase(remove_if(p.begin(), p.end(), [&count, &dup_ptr, duplicates](const Rect&){
             if (dup_ptr > duplicates.size())
                 return false;
             bool d = duplicates[dup_ptr] == count;
@@ -134,7 +122,7 @@ void filterByDuplicate(vector<Rect>& p) {
     
 }
 
-void padRegion(const CImg<>& image, vector<Rect>& p, int padding) {
+void padRegion(const CImg<unsigned char>& image, vector<Rect>& p, int padding) {
     
     for (auto& r : p) {
         
@@ -162,15 +150,68 @@ void padRegion(const CImg<>& image, vector<Rect>& p, int padding) {
 
 //projection
 
-vector<int> vertical_projection(CImg<unsigned char> image_Y, Block_1D l, unsigned char threshold) {
+/*
+*	Ink mask of the page, 1 where the luma is darker than the
+*	threshold, together with its per-row ink counts.
+*/
+struct InkProjection {
+    int width;
+    int height;
+    vector<unsigned char> mask;
+    vector<int> h_stat;
+};
+
+InkProjection ink_projection(const CImg<unsigned char>& image, unsigned char threshold) {
+    
+    InkProjection p;
+    p.width = image.width();
+    p.height = image.height();
+    p.mask.assign((size_t)p.width * p.height, 0);
+    p.h_stat.assign(p.height, 0);
+    
+    if (image.spectrum() >= 3) {
+        //Same luma as RGBtoYCbCr: Y = (66R + 129G + 25B + 128) / 256 + 16,
+        //compared in integers so no YCbCr copy is made.
+        const int lim = (threshold - 16) * 256 - 128;
+        for (int y = 0; y < p.height; y++) {
+            const unsigned char* r = image.data(0, y, 0, 0);
+            const unsigned char* g = image.data(0, y, 0, 1);
+            const unsigned char* b = image.data(0, y, 0, 2);
+            unsigned char* m = &p.mask[(size_t)y * p.width];
+            int count = 0;
+            for (int x = 0; x < p.width; x++) {
+                m[x] = (66 * r[x] + 129 * g[x] + 25 * b[x]) < lim;
+                count += m[x];
+            }
+            p.h_stat[y] = count;
+        }
+    }
+    else {
+        for (int y = 0; y < p.height; y++) {
+            const unsigned char* v = image.data(0, y);
+            unsigned char* m = &p.mask[(size_t)y * p.width];
+            int count = 0;
+            for (int x = 0; x < p.width; x++) {
+                m[x] = v[x] < threshold;
+                count += m[x];
+            }
+            p.h_stat[y] = count;
+        }
+    }
+    
+    return p;
+    
+}
+
+vector<int> vertical_projection(const InkProjection& p, Block_1D l) {
     
-    vector<int> v_stat = vector<int>(image_Y.width(), 0);
+    vector<int> v_stat = vector<int>(p.width, 0);
+    int* v = v_stat.data();
     
     for (int y = l.begin; y < l.end; y++) {
-        for (int x = 0; x < image_Y.width(); x++) {
-            if (image_Y(x, y) < threshold) {
-                v_stat[x]++;
-            }
+        const unsigned char* m = &p.mask[(size_t)y * p.width];
+        for (int x = 0; x < p.width; x++) {
+            v[x] += m[x];
         }
     }
     
@@ -178,18 +219,19 @@ vector<int> vertical_projection(CImg<unsigned char> image_Y, Block_1D l, unsigne
     
 }
 
-vector<int> horizontal_projection(CImg<unsigned char> image_Y, unsigned char threshold) {
+//Sliding window average over [i, i + window_size), via prefix sums.
+void smooth_by_window(vector<int>& v, size_t window_size) {
     
-    vector<int> h_stat = vector<int>(image_Y.height(), 0);
+    if (v.size() <= window_size) return;
     
-    cimg_forXY(image_Y, x, y) {
-        
-        if (image_Y(x, y) < threshold) {
-            h_stat[y]++;
-        }
+    vector<int> prefix(v.size() + 1, 0);
+    for (size_t i = 0; i < v.size(); i++) {
+        prefix[i+1] = prefix[i] + v[i];
     }
     
-    return h_stat;
+    for (size_t i = 0; i < v.size() - window_size; i++) {
+        v[i] = (prefix[i+window_size] - prefix[i]) / (int)window_size;
+    }
     
 }
 
@@ -198,16 +240,10 @@ vector<Block_1D> split_by_histogram(vector<int> v, int min_width = 10) {
     vector<Block_1D> blocks;
     vector<int> block_height;
     
+    if (v.size() < 2) return blocks;
+    
     //smoothing
-    int window_size = 30;
-    for (int i = 0; i < v.size() - window_size; i++) {
-        int avg = 0;
-        for (int j = i; j < i+window_size; j++) {
-            avg += v[j];
-        }
-        avg /= window_size;
-        v[i] = avg;
-    }
+    smooth_by_window(v, 30);
     
     vector<int> dv(v.size(), 0);
     //1st and 2nd derivatives
@@ -225,24 +261,25 @@ vector<Block_1D> split_by_histogram(vector<int> v, int min_width = 10) {
             int b = i + min_width;
             while (b < dv.size() && dv[b] < 0) b++;
             
+            int lo = max(a, 0);
+            int hi = min(b, (int)v.size());
             int avg_block_height = 0;
-            for (int i = a; i < b; i++) {
-                avg_block_height += v[i];
+            for (int k = lo; k < hi; k++) {
+                avg_block_height += v[k];
             }
-            avg_block_height /= (b - a);
-            block_height.push_back(avg_block_height);
-            total_average_block_height += avg_block_height;
+            if (hi > lo) avg_block_height /= (hi - lo);
             
             if (a >= 0 && b < v.size()) {
                 blocks.push_back({a, b});
-                cout << "Found block: " << a << " " << b << " " << avg_block_height << endl;
+                block_height.push_back(avg_block_height);
+                total_average_block_height += avg_block_height;
             }
             i = b;
         }
     }
-    total_average_block_height /= blocks.size();
     
-    cout << blocks.size() << endl;
+    if (blocks.empty()) return blocks;
+    total_average_block_height /= blocks.size();
     
     for (int i = 0; i < block_height.size();) {
         if (block_height[i] < total_average_block_height * 0.5) {
@@ -257,99 +294,30 @@ vector<Block_1D> split_by_histogram(vector<int> v, int min_width = 10) {
     return blocks;
 }
 
-void draw_histogram_line(vector<int> v) {
-    
-    //Sliding window smoothing
-    int window_size = 10;
-    for (int i = 0; i < v.size() - window_size; i++) {
-        int avg = 0;
-        for (int j = i; j < i+window_size; j++) {
-            avg += v[j];
-        }
-        avg /= window_size;
-        v[i] = avg;
-    }
-    
-    int max_i = argMax(v);
-    CImg<unsigned char> hist(v[max_i] + 1, (int)v.size() + 1, 1, 1, 0);
-    
-    for (int y = 0; y < v.size(); y++) {
-        for (int x = 0; x < v[y]; x++) {
-            hist(x, y) = 255;
-        }
-    }
-    
-    hist.display();
-    
-}
-
-void draw_histogram_col(vector<int> v) {
-    
-    //Sliding window smoothing
-    int window_size = 10;
-    for (int i = 0; i < v.size() - window_size; i++) {
-        int avg = 0;
-        for (int j = i; j < i+window_size; j++) {
-            avg += v[j];
-        }
-        avg /= window_size;
-        v[i] = avg;
-    }
-    
-    int max_i = argMax(v);
-    CImg<unsigned char> hist((int)v.size(), v[max_i] + 1, 1, 1, 0);
-    
-    for (int x = 0; x < v.size(); x++) {
-        for (int y = 0; y < v[x]; y++) {
-            hist(x, v[max_i] - y) = 255;
-        }
-    }
-    
-    hist.display();
-    
-}
-
-void draw_histogram_dline(vector<int> v) {
-    
-    int window_size = 10;
-    for (int i = 0; i < v.size() - window_size; i++) {
-        int avg = 0;
-        for (int j = i; j < i+window_size; j++) {
-            avg += v[j];
-        }
-        avg /= window_size;
-        v[i] = avg;
-    }
-    
-    for (int i = 0; i < v.size() - 1; i++) {
-        v[i] = v[i+1] - v[i];
-        cout << v[i] << " ";
-    }
-    cout << endl;
-    
-}
-
-
-vector<Rect> text_projDetection(CImg<unsigned char> image) {
+vector<Rect> text_projDetection(const CImg<unsigned char>& image) {
     
     vector<Rect> proposals;
-    CImg<unsigned char> image_Y = image.get_RGBtoYCbCr().get_channel(0);
     
     //Line Split
     unsigned char threshold = 128;
-    vector<int> h_stat = horizontal_projection(image_Y, threshold);
-    draw_histogram_line(h_stat);
-    vector<Block_1D> lines = split_by_histogram(h_stat);
-    cout << lines.size() << endl;
+    InkProjection proj = ink_projection(image, threshold);
+    vector<Block_1D> lines = split_by_histogram(proj.h_stat);
     
     //For each line, split text regions
     for (Block_1D l : lines) {
         if (l.begin < 0 || l.end >= image.height()) {
             continue;
         }
-        vector<int> v_stat = vertical_projection(image_Y, l, threshold);
-        draw_histogram_col(v_stat);
+        vector<int> v_stat = vertical_projection(proj, l);
         vector<Block_1D> cols = split_by_histogram(v_stat);
+        if (cols.empty()) {
+            continue;
+        }
+        
+        //Same line delimiter as ScanLineDet::getSorted
+        if (!proposals.empty()) {
+            proposals.push_back(Rect(-1, -1, -1, -1));
+        }
         
         for (Block_1D c : cols) {
             Rect r = {c.begin, l.begin, c.end-c.begin, l.end-l.begin};
@@ -357,8 +325,6 @@ vector<Rect> text_projDetection(CImg<unsigned char> image) {
         }
     }
     
-    RectangleAll(image, proposals);
-    
     return proposals;
     
 }
@@ -17,10 +17,12 @@ using namespace cimg_library;
 using namespace ct;
 
 //Detect Text Region via maximum-connected region traverse
-vector<Rect> text_contourDetection(CImg<> image);
+vector<Rect> text_contourDetection(const CImg<unsigned char>& image, const DisplayPolicy& disp = DisplayPolicy());
 
 //Detect Text Region via horizontal/vertical projection
-vector<Rect> text_projDetection(CImg<unsigned char> image);
+//Faster than contour detection on cleanly printed grid forms,
+//returns rects in the same line-delimited order.
+vector<Rect> text_projDetection(const CImg<unsigned char>& image);
 
 inline void Rectangle(CImg<unsigned char>& img, Rect r) {
     
@@ -49,7 +51,10 @@ inline void Rectangle(CImg<unsigned char>& img, Rect r) {
     }
 }
 
-inline void RectangleAll(CImg<unsigned char> img, vector<Rect> rs) {
+inline void RectangleAll(const CImg<unsigned char>& img, const vector<Rect>& rs, const DisplayPolicy& disp = DisplayPolicy()) {
+    
+    if (!disp.enabled())
+        return;
     
     CImg<unsigned char> t(img);
     
@@ -58,7 +63,7 @@ inline void RectangleAll(CImg<unsigned char> img, vector<Rect> rs) {
             Rectangle(t, rs[i]);
     }
     
-    t.display();
+    disp.display(t);
 }
 
 
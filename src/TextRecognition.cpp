@@ -7,220 +7,544 @@
 //
 
 #include "TextRecognition.hpp"
+#include <climits>
 
-svm_model* model;
-svm_node* nodes;
+TextRecognizer::TextRecognizer()
+    : model(NULL), cnn_loaded(false), cnn_backend(CNN_DEFAULT), cascade_digits(0), cascade_accepted(0),
+      model_generation(0) {}
 
-Model tf_model;
+TextRecognizer::~TextRecognizer() {
+    if (model != NULL)
+        svm_free_and_destroy_model(&model);
+}
 
-CImg<> cimgFromRect(const CImg<>& image, Rect region) {
+unique_ptr<TextRecognizer::Workspace> TextRecognizer::acquire() const {
     
-    CImg<> ROI(region.width, region.height, 1, image._spectrum);
+    unique_ptr<Workspace> ws;
+    {
+        lock_guard<mutex> lock(pool_lock);
+        if (!pool.empty()) {
+            ws = move(pool.back());
+            pool.pop_back();
+        }
+    }
+    if (!ws) {
+        ws.reset(new Workspace());
+        ws->cnn_generation = 0;
+    }
+    //The native CNN keeps its activations in the object, so every
+    //workspace runs its own copy of the loaded weights
+    if (cnn_loaded && cnn_backend != CNN_TENSORFLOW && ws->cnn_generation != model_generation) {
+        ws->cnn = cnn;
+        ws->cnn_generation = model_generation;
+    }
+    return ws;
+}
+
+void TextRecognizer::release(unique_ptr<Workspace> ws) const {
+    lock_guard<mutex> lock(pool_lock);
+    pool.push_back(move(ws));
+}
+
+//Answers what the digit cache and the cascade can, -1 elsewhere, moves
+//the remaining digits to the front of batch and returns their indices
+vector<int> TextRecognizer::escalate(Workspace& ws, float* batch, int n, uint32_t version,
+                                     vector<int>& recognized) const {
     
-    cimg_forC(ROI, c) {
-        cimg_forXY(ROI, x, y) {
-            if (region.x + x < image._width && region.y + y < image._height) {
-                ROI(x, y, c) = image(region.x + x, region.y + y, c);
+    const int digit_len = DIGIT_SIZE * DIGIT_SIZE;
+    recognized.assign(n, -1);
+    vector<DigitKey>& page_keys = ws.page_keys;
+    page_keys.clear();
+    ws.page_repeats.clear();
+    
+    //Repeats within the page are classified once too
+    unordered_map<DigitKey, int, DigitKeyHash> first;
+    
+    vector<int> rest;
+    for (int k = 0; k < n; k++) {
+        const float* digit = batch + (size_t)k * digit_len;
+        if (digit_cache.enabled()) {
+            DigitKey key = DigitCache::key(digit, version);
+            if (digit_cache.lookup(key, recognized[k]))
+                continue;
+            auto seen = first.insert(make_pair(key, k));
+            if (!seen.second) {
+                ws.page_repeats.push_back(make_pair(k, seen.first->second));
+                continue;
             }
+            page_keys.push_back(key);
         }
+        if ((int)rest.size() != k)
+            memcpy(batch + rest.size() * digit_len, digit, digit_len * sizeof(float));
+        rest.push_back(k);
     }
     
-    return ROI;
+    if (cascade.ready() && !rest.empty()) {
+        vector<int>& labels = ws.labels;
+        labels.resize(rest.size());
+        const int answered = cascade.classify(batch, (int)rest.size(), labels.data(), ws.logits);
+        cascade_digits += rest.size();
+        cascade_accepted += answered;
+        
+        size_t m = 0;
+        for (size_t k = 0; k < rest.size(); k++) {
+            if (labels[k] >= 0) {
+                recognized[rest[k]] = labels[k];
+                if (digit_cache.enabled())
+                    digit_cache.insert(page_keys[k], labels[k]);
+                continue;
+            }
+            if (m != k) {
+                memcpy(batch + m * digit_len, batch + k * digit_len, digit_len * sizeof(float));
+                if (digit_cache.enabled())
+                    page_keys[m] = page_keys[k];
+            }
+            rest[m++] = rest[k];
+        }
+        rest.resize(m);
+        if (digit_cache.enabled())
+            page_keys.resize(m);
+    }
+    return rest;
 }
 
-CImg<> negative(const CImg<>& img) {
-    CImg<> n = img.get_normalize(0, 1);
+//Caches the classifier's labels for the digits escalate() returned
+//and copies them to the repeats it held back
+void TextRecognizer::remember(Workspace& ws, const vector<int>& escalated, vector<int>& recognized) const {
     
-    cimg_forXY(img, x, y) {
-        n(x, y) = 1 - img(x, y);
+    if (!digit_cache.enabled())
+        return;
+    for (size_t k = 0; k < escalated.size(); k++) {
+        if (recognized[escalated[k]] >= 0)
+            digit_cache.insert(ws.page_keys[k], recognized[escalated[k]]);
+    }
+    for (auto& r : ws.page_repeats) {
+        recognized[r.first] = recognized[r.second];
     }
-    
-    return n;
 }
 
-void nodeFromCImg(const CImg<>& img) {
+static void nodeFromDigit(const float* digit, int n, vector<svm_node>& nodes) {
     
-    assert(img._spectrum == 1); //Must be grayscaled image
-    if (nodes != NULL) {
-        free(nodes);
-    }
-    nodes = (svm_node*) malloc((img.width() * img.height() + 1) * sizeof(svm_node));
-//    nodes = (svm_node*) realloc(nodes, (img.width() * img.height() + 1) * sizeof(svm_node));
+    //At most one node per pixel, allocated once per workspace
+    nodes.resize(n + 1);
     
+    //Sparse, the digit is 0 / 1 so the kernel only visits ink pixels
     int i = 0;
-    for (; i < img.width() * img.height(); i++) {
-        nodes[i].index = i;
-        nodes[i].value = img.data()[i];
+    for (int p = 0; p < n; p++) {
+        if (digit[p] != 0) {
+            nodes[i].index = p;
+            nodes[i].value = digit[p];
+            i++;
+        }
     }
     //Last dimension set as -1
     nodes[i].index = -1;
     
 }
 
-void load_model() {
+bool TextRecognizer::load_svm(const string& model_path, const string& binary_path, const string& pca_path,
+                              int rff_features) {
+    
+    model_generation++;
     
-    string filename = "../../../model/mnist.model";
+    //Optional PCA front-end, the model is then trained on its output
+    int dim = DIGIT_SIZE * DIGIT_SIZE;
+    if (svm_pca.load(pca_path.c_str())) {
+        if (svm_pca.input_dim() != dim) {
+            cout << "SVM PCA does not match the digit size, please check " + pca_path << endl;
+            return false;
+        }
+        dim = svm_pca.output_dim();
+        cout << "SVM PCA Loaded, " << dim << " features" << endl;
+    }
+    
+    //Converted by tools/svm_convert, mapped read only and shared
+    //between processes, no parsing
+    if (dense_svm.map(binary_path.c_str()) && dense_svm.dimension() == dim) {
+        cout << "SVM Model Mapped" << endl;
+        dense_svm.approximate(rff_features);
+        return true;
+    }
     
     cout << "Loading SVM Model" << endl;
-    model = svm_load_model(filename.c_str());
-    if (model != NULL) {
-        cout << "SVM Model Loaded" << endl;
+    if (model != NULL)
+        svm_free_and_destroy_model(&model);
+    model = svm_load_model(model_path.c_str());
+    if (model == NULL) {
+        cout << "SVM Model Load Fail, please check path." + model_path << endl;
+        return false;
     }
-    else {
-        cout << "SVM Model Load Fail, please check path." + filename << endl;
-        exit(0);
+    cout << "SVM Model Loaded" << endl;
+    //Batched float32 RBF when the model allows it, svm_predict() otherwise
+    if (dense_svm.init(model, dim))
+        dense_svm.approximate(rff_features);
+    return true;
+}
+
+vector<int> TextRecognizer::recognize_num(const CImg<unsigned char>& image, const vector<Rect>& regions) const {
+    
+    vector<int> recognized_num;
+    const int padding = 15;
+    const int digit_len = DIGIT_SIZE * DIGIT_SIZE;
+    unique_ptr<Workspace> ws = acquire();
+    vector<float>& svm_batch = ws->page_batch;
+    
+    //Gray, binarize, negate, pad, resize to 28x28 and rethreshold
+    int n = 0;
+    for (auto& r : regions) {
+        if (r.x != -1) n++;
     }
+    svm_batch.resize((size_t)n * digit_len);
+    int k = 0;
+    for (auto& r : regions) {
+        if (r.x != -1)
+            ws->preprocessor.process(image, r, padding, &svm_batch[(size_t)k++ * digit_len]);
+    }
+    
+    //Cached and easy digits stop here, the rest move to the front
+    vector<int> escalated = escalate(*ws, svm_batch.data(), n, classifier_version(false), recognized_num);
+    const int m = (int)escalated.size();
+    
+    //Compute feature vectors
+    const float* features = svm_batch.data();
+    int feature_len = digit_len;
+    if (svm_pca.ready() && m > 0) {
+        feature_len = svm_pca.output_dim();
+        ws->features.resize((size_t)m * feature_len);
+        svm_pca.project(svm_batch.data(), m, ws->features.data());
+        features = ws->features.data();
+    }
+    
+    if (dense_svm.ready()) {
+        //Whole page against all SVs in one GEMM
+        vector<int> predicted = dense_svm.predict(features, m);
+        for (k = 0; k < m; k++)
+            recognized_num[escalated[k]] = predicted[k];
+    }
+    else if (model != NULL) {
+        for (k = 0; k < m; k++) {
+            nodeFromDigit(features + (size_t)k * feature_len, feature_len, ws->nodes);
+            recognized_num[escalated[k]] = (int)svm_predict(model, ws->nodes.data());
+        }
+    }
+    remember(*ws, escalated, recognized_num);
+    release(move(ws));
+    
+    return recognized_num;
+    
+}
+
+bool TextRecognizer::load_cascade(const string& weights_path, float margin) {
+    
+    model_generation++;
+    if (!cascade.load(weights_path.c_str())) {
+        cout << "Cascade Model Load Fail, please check path. " << weights_path << endl;
+        return false;
+    }
+    //classify() reads DIGIT_SIZE x DIGIT_SIZE floats per digit
+    if (cascade.input_dim() != DIGIT_SIZE * DIGIT_SIZE || cascade.num_classes() != 10) {
+        cout << "Cascade Model " << weights_path << " is " << cascade.input_dim() << " x " << cascade.num_classes()
+             << ", expected " << DIGIT_SIZE * DIGIT_SIZE << " x 10" << endl;
+        cascade = Cascade();
+        return false;
+    }
+    cascade.margin = margin;
+    return true;
+}
+
+void TextRecognizer::report_cascade(ostream& out) const {
+    
+    const long digits = cascade_digits, accepted = cascade_accepted;
+    if (digits == 0)
+        return;
+    out << "Cascade answered " << accepted << " of " << digits << " digits, "
+         << 100.0 * (digits - accepted) / digits << "% escalated" << endl;
+}
+
+void TextRecognizer::init_digit_cache(size_t entries) {
+    digit_cache.init(entries);
 }
 
-void free_model() {
-    svm_free_and_destroy_model(&model);
+void TextRecognizer::report_digit_cache(ostream& out) const {
+    
+    const uint64_t lookups = digit_cache.hits() + digit_cache.misses();
+    if (lookups == 0)
+        return;
+    out << "Digit cache hit " << digit_cache.hits() << " of " << lookups << " digits ("
+         << 100.0 * digit_cache.hits() / lookups << "%), " << digit_cache.size() << " entries" << endl;
 }
 
-vector<int> recognize_num(const CImg<unsigned char>& image, vector<Rect> regions) {
+bool TextRecognizer::load_cnn(CNNBackend backend, const string& weights_path,
+                              const string& graph_path, const string& checkpoint_path) {
+    
+    model_generation++;
+    batcher.reset();
+    cnn_backend = backend;
+    cnn_loaded = false;
+    
+    if (backend == CNN_NATIVE || backend == CNN_NATIVE_INT8) {
+        if (!cnn.load(weights_path.c_str())) {
+            cout << "CNN Model Load Fail, please check path. " << weights_path << endl;
+            return false;
+        }
+        if (backend == CNN_NATIVE_INT8 && !cnn.has_int8()) {
+            cout << "CNN Model has no int8 calibration, re-export it. " << weights_path << endl;
+            return false;
+        }
+        cnn.use_int8 = backend == CNN_NATIVE_INT8;
+        cnn_loaded = true;
+        return true;
+    }
+    
+#ifndef DIGITSCANNER_NO_TENSORFLOW
+    if (!tf_model.load_graph(graph_path.c_str()) || !tf_model.create_session() ||
+        !tf_model.restore_weights(checkpoint_path.c_str()) || !tf_model.create_output("dense2/BiasAdd")) {
+        cout << "TensorFlow Model Load Fail, please check path. " << graph_path << " " << checkpoint_path << endl;
+        return false;
+    }
+    cnn_loaded = true;
+    return true;
+#else
+    (void)graph_path;
+    (void)checkpoint_path;
+    cout << "Built without TensorFlow, use the native CNN backend." << endl;
+    return false;
+#endif
+    
+}
+
+vector<int> TextRecognizer::tfrecognize_num(const CImg<unsigned char>& image, const vector<Rect>& regions,
+                                            int max_batch) const {
     
     vector<int> recognized_num;
-    const int padding = 15;
+    const int padding = 10;
+    const int digit_len = DIGIT_SIZE * DIGIT_SIZE;
+    unique_ptr<Workspace> ws = acquire();
+    vector<float>& page_batch = ws->page_batch;
     
+    vector<const Rect*> digits;
     for (auto& r : regions) {
-        
-//        cout << r.x << endl;
         if (r.x != -1)
-        {
-            CImg<> ROI = cimgFromRect(image, r);
-            
-            //Convert to Gray
-            CImg<> gray = ROI.RGBtoYCbCr().get_channel(0);
-            //Binarilized
-            gray.threshold(128);
-            //Negate
-            CImg<> neg = negative(gray);
-            //Pad Image
-            CImg<float> pad(neg.width() + 2*padding, neg.height() + 2*padding, 1, 1, 0);
-            cimg_forXY(neg, x, y) {
-                pad(x+padding, y+padding) = neg(x, y);
+            digits.push_back(&r);
+    }
+    int n = (int)digits.size();
+    
+    //With a digit cache or a cascade the page is preprocessed up front
+    //and only the digits neither can answer reach the CNN. The batcher
+    //reads its digits from there too.
+    const bool staged = digit_cache.enabled() || cascade.ready() || batcher;
+    vector<int> escalated;
+    if (staged) {
+        page_batch.resize((size_t)n * digit_len);
+        for (int k = 0; k < n; k++) {
+            ws->preprocessor.process(image, *digits[k], padding, &page_batch[(size_t)k * digit_len]);
+        }
+        escalated = escalate(*ws, page_batch.data(), n, classifier_version(true), recognized_num);
+    }
+    else {
+        recognized_num.assign(n, -1);
+        for (int k = 0; k < n; k++) {
+            escalated.push_back(k);
+        }
+    }
+    const int m = (int)escalated.size();
+    if (max_batch <= 0) max_batch = max(m, 1);
+    
+    //Slices of the page join the runs of other pages in flight
+    if (batcher && cnn_loaded) {
+        const int slice = min(max_batch, batcher->max_batch());
+        vector<future<vector<int> > > results;
+        results.reserve((m + slice - 1) / slice);
+        //Every slice reads page_batch, so all of them are waited for
+        //before a failed one can unwind past ws
+        try {
+            for (int i = 0; i < m; i += slice) {
+                results.push_back(batcher->submit(&page_batch[(size_t)i * digit_len], min(slice, m - i)));
             }
+        }
+        catch (...) {
+            for (auto& result : results) {
+                result.wait();
+            }
+            throw;
+        }
+        for (auto& result : results) {
+            result.wait();
+        }
+        for (size_t r = 0; r < results.size(); r++) {
+            vector<int> predicted = results[r].get();
+            for (size_t k = 0; k < predicted.size(); k++) {
+                recognized_num[escalated[r * slice + k]] = predicted[k];
+            }
+        }
+    }
+    
+    //One session run per max_batch digits
+    for (int i = 0; i < m && cnn_loaded && !batcher; i += max_batch) {
+        int b = min(max_batch, m - i);
+        
+        float* batch = NULL;
+        int64_t shape = b;
+#ifndef DIGITSCANNER_NO_TENSORFLOW
+        unique_lock<mutex> session;
+#endif
+        
+        if (cnn_backend != CNN_TENSORFLOW) {
+            ws->batch.resize((size_t)b * digit_len);
+            batch = ws->batch.data();
+        }
+        else {
+#ifndef DIGITSCANNER_NO_TENSORFLOW
+            //Round the batch up to a power of two, so only a few
+            //tensor shapes are ever pooled. Padding rows are ignored.
+            shape = 1;
+            while (shape < b) shape *= 2;
             
-//            CImg<float> fitResize(28, 28, 1, 1, 0);
-//            if (pad.width() > pad.height())
-//            {
-//                float f = 28. / pad.width();
-//                pad.resize(28, pad.height() * f, 1, 1, 3);
-//                
-//                int offsetY = (28 - pad.height()) / 2;
-//                
-//                cimg_forXY(pad, x, y)
-//                {
-//                    fitResize(x, y + offsetY) = pad(x, y);
-//                }
-//                
-//            }
-//            else
-//            {
-//                float f = 28. / pad.height();
-//                pad.resize(pad.width() * f, 28, 1, 1, 3);
-//                
-//                int offsetX = (28 - pad.width()) / 2;
-//                
-//                cimg_forXY(pad, x, y)
-//                {
-//                    fitResize(x + offsetX, y) = pad(x, y);
-//                }
-//            }
-//            fitResize.threshold(0.4);
-            
-            
-            //Normalize
-            pad.resize(28, 28, 1, 1, 3);
-            //Rethreshold
-            pad.threshold(0.65);
-            
-            
-            //Compute feature vector;
-            nodeFromCImg(pad);
-//            nodeFromCImg(fitResize);
-            
-            int predicted = svm_predict(model, nodes);
-//            cout << "I guess this number is: " << predicted << endl;
-//            fitResize.display();
-//            pad.display();
-            cout << predicted << " ";
-            recognized_num.push_back(predicted);
-
+            session = unique_lock<mutex>(tf_lock);
+            tf_model.clear_input();
+            batch = tf_model.input_buffer("input_image", {shape, DIGIT_SIZE, DIGIT_SIZE, 1});
+            //A failed run leaves the rest of the page at -1
+            if (batch == NULL)
+                break;
+#endif
         }
-        else
-        {
-            cout << endl;
+        
+        //Gray, binarize, negate, pad, resize to 28x28 and rethreshold
+        //straight into the input tensor
+        for (int k = 0; k < b; k++) {
+            if (staged)
+                memcpy(batch + k * digit_len, &page_batch[(size_t)(i + k) * digit_len], digit_len * sizeof(float));
+            else
+                ws->preprocessor.process(image, *digits[escalated[i + k]], padding, batch + k * digit_len);
         }
+        memset(batch + b * digit_len, 0, (shape - b) * digit_len * sizeof(float));
         
+        vector<int> predicted;
+        if (cnn_backend != CNN_TENSORFLOW) {
+            predicted = ws->cnn.predict(batch, b);
+        }
+        else {
+#ifndef DIGITSCANNER_NO_TENSORFLOW
+            predicted = tf_model.predict();
+#endif
+        }
+        for (int k = 0; k < min(b, (int)predicted.size()); k++) {
+            recognized_num[escalated[i + k]] = predicted[k];
+        }
     }
+    remember(*ws, escalated, recognized_num);
+    release(move(ws));
     
-    cout << endl;
     return recognized_num;
     
 }
 
-void load_tfmodel() {
+vector<int> TextRecognizer::run_cnn(CNN& net, const float* input, int n) const {
     
-    const char* graph_path = "./model/graph.pb";
-    const char* checkpoint_path = "./model/mnist_-94000";
+    if (cnn_backend != CNN_TENSORFLOW)
+        return net.predict(input, n);
     
-    tf_model.load_graph(graph_path);
-    tf_model.create_session();
-    tf_model.restore_weights(checkpoint_path);
+#ifndef DIGITSCANNER_NO_TENSORFLOW
+    const int digit_len = DIGIT_SIZE * DIGIT_SIZE;
+    int64_t shape = 1;
+    while (shape < n) shape *= 2;
     
+    lock_guard<mutex> session(tf_lock);
+    tf_model.clear_input();
+    float* batch = tf_model.input_buffer("input_image", {shape, DIGIT_SIZE, DIGIT_SIZE, 1});
+    if (batch == NULL)
+        return vector<int>(n, -1);
+    memcpy(batch, input, (size_t)n * digit_len * sizeof(float));
+    memset(batch + (size_t)n * digit_len, 0, (shape - n) * digit_len * sizeof(float));
+    return tf_model.predict();
+#else
+    return vector<int>();
+#endif
 }
 
-vector<int> tfrecognize_num(const CImg<unsigned char>& image, vector<Rect> regions) {
+void TextRecognizer::enable_batching(int max_batch, int max_wait_us) {
     
-//    CImg<float> img_f = image.get_normalize(0, 1);
-    vector<int> recognized_num;
+    batcher.reset();
+    if (max_batch <= 0 || !cnn_loaded)
+        return;
+    if (cnn_backend != CNN_TENSORFLOW)
+        batch_cnn = cnn;
+    batcher.reset(new InferenceBatcher([this](const float* input, int n) {
+        return run_cnn(batch_cnn, input, n);
+    }, DIGIT_SIZE * DIGIT_SIZE, max_batch, max_wait_us));
+}
+
+bool TextRecognizer::batching_stats(InferenceBatcher::Stats& stats) const {
     
-    tf_model.create_output("dense2/BiasAdd", std::vector<float>(10, 0.), {10});
+    if (!batcher)
+        return false;
+    stats = batcher->stats();
+    return true;
+}
+
+void TextRecognizer::report_batching(ostream& out) const {
     
-    for (auto& r : regions) {
-        
-        if (r.x != -1)
-        {
-            CImg<> ROI = cimgFromRect(image, r);
-            
-            //Convert to Gray
-            CImg<> gray = ROI.RGBtoYCbCr().get_channel(0);
-            //Binarilized
-            gray.threshold(128);
-            //Negate
-            CImg<> neg = negative(gray);
-            //Pad Image
-            int padding = 10;
-            CImg<float> pad(neg.width() + 2*padding, neg.height() + 2*padding, 1, 1, 0);
-            cimg_forXY(neg, x, y) {
-                pad(x+padding, y+padding) = neg(x, y);
-            }
-            
-            //Normalize
-            pad.resize(28, 28, 1, 1, 3);
-            //Rethreshold
-            pad.threshold(0.65);
+    InferenceBatcher::Stats st;
+    if (!batching_stats(st) || st.runs == 0)
+        return;
+    out << "Batcher ran " << st.inputs << " digits of " << st.requests << " requests in " << st.runs << " runs, "
+        << 100.0 * st.mean_fill << "% full, " << st.full_runs << " flushed full, waited "
+        << st.mean_wait_ms << " ms mean, " << st.max_wait_ms << " ms max" << endl;
+}
 
-//            pad.display();
-            
-            
-            tf_model.clear_input();
-            tf_model.create_input("input_image", vector<float>(pad.data(),
-                                                               pad.data() + pad.width() * pad.height() * sizeof(float)),
-                                                                {1, 28, 28, 1});
-            
-            int predicted = tf_model.predict();
-            cout << predicted << " ";
-            
-            recognized_num.push_back(predicted);
-            
+vector<int> TextRecognizer::tfrecognize_lines(const CImg<unsigned char>& image, const vector<Rect>& regions) const {
+    
+    //The TF graph only takes 28x28 digits
+    if (cnn_backend == CNN_TENSORFLOW || !cnn_loaded)
+        return tfrecognize_num(image, regions);
+    
+    vector<int> recognized_num;
+    const int padding = 10;
+    unique_ptr<Workspace> ws = acquire();
+    
+    vector<const Rect*> line;
+    for (size_t i = 0; i <= regions.size(); i++) {
+        if (i < regions.size() && regions[i].x != -1) {
+            line.push_back(&regions[i]);
+            continue;
+        }
+        if (line.empty())
+            continue;
+        
+        //One scale for the line, so its median padded digit comes out at 28 pixels
+        vector<int> heights;
+        int x0 = INT_MAX, y0 = INT_MAX, x1 = INT_MIN, y1 = INT_MIN;
+        for (auto r : line) {
+            heights.push_back(r->height + 2 * padding);
+            x0 = min(x0, r->x);
+            y0 = min(y0, r->y);
+            x1 = max(x1, r->x + r->width);
+            y1 = max(y1, r->y + r->height);
+        }
+        nth_element(heights.begin(), heights.begin() + heights.size() / 2, heights.end());
+        const float scale = (float)DIGIT_SIZE / heights[heights.size() / 2];
+        
+        Rect strip(x0, y0, x1 - x0, y1 - y0);
+        const int sw = max(1, (int)lround((strip.width + 2 * padding) * scale));
+        const int sh = max(1, (int)lround((strip.height + 2 * padding) * scale));
+        const float sx = (float)sw / (strip.width + 2 * padding);
+        const float sy = (float)sh / (strip.height + 2 * padding);
+        
+        //Same binarization and resampling as the digit crops
+        ws->line.resize((size_t)sw * sh);
+        ws->preprocessor.process(image, strip, padding, sw, sh, ws->line.data());
+        
+        vector<pair<float, float> > centers;
+        for (auto r : line) {
+            centers.push_back(make_pair((r->x + r->width / 2.f - x0 + padding) * sx,
+                                        (r->y + r->height / 2.f - y0 + padding) * sy));
         }
-        else
-            cout << endl;
         
+        vector<int> predicted = ws->cnn.predict_regions(ws->line.data(), sh, sw, centers);
+        recognized_num.insert(recognized_num.end(), predicted.begin(), predicted.end());
+        line.clear();
     }
-    
-    cout << endl;
+    release(move(ws));
     
     return recognized_num;
     
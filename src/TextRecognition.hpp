@@ -11,18 +11,179 @@
 
 #include "headers.h"
 #include "Contour.hpp"
+#include "DigitPreprocess.hpp"
+#include "CNN.hpp"
+#include "DenseSVM.hpp"
+#include "PCA.hpp"
+#include "Cascade.hpp"
+#include "DigitCache.hpp"
+#include "InferenceBatcher.hpp"
 #include <svm.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
 
 using namespace std;
 using namespace cimg_library;
 using namespace ct;
 
-void load_model();
-void free_model();
+//Inference backends of the CNN classifier
+enum CNNBackend {
+    CNN_TENSORFLOW,     //libtensorflow session on model/graph.pb
+    CNN_NATIVE,         //CNN on Eigen with model/cnn_weights.bin
+    CNN_NATIVE_INT8     //same weights quantized to int8, needs calibration in the file
+};
 
-vector<int> recognize_num(const CImg<unsigned char>& image, vector<Rect> regions);
+#ifdef DIGITSCANNER_NO_TENSORFLOW
+const CNNBackend CNN_DEFAULT = CNN_NATIVE;
+#else
+const CNNBackend CNN_DEFAULT = CNN_TENSORFLOW;
+#endif
 
-void load_tfmodel();
-vector<int> tfrecognize_num(const CImg<unsigned char>& image, vector<Rect> regions);
+//Digit classifiers of a scanner. Loading is not thread safe and has to
+//finish before the first page. After that the models are only read and
+//the recognize functions may run on any number of threads: the buffers
+//of a call come from a pool of workspaces, each with its own copy of
+//the native CNN, and TensorFlow session runs take turns.
+class TextRecognizer {
+
+public:
+
+    TextRecognizer();
+    ~TextRecognizer();
+
+    /**
+     *  load_svm():
+     *  The converted model is mapped if it matches, the libsvm text
+     *  model is parsed otherwise. The PCA front-end is optional.
+     *  @param
+     *  rff_features: > 0 approximates the RBF kernel with that many
+     *  random Fourier features, faster on models with many more SVs,
+     *  less exact
+     *  @return
+     *  false if no model could be loaded, the reason is printed
+     */
+    bool load_svm(const string& model_path, const string& binary_path, const string& pca_path,
+                  int rff_features = 0);
+
+    /**
+     *  load_cnn():
+     *  @param
+     *  weights_path: native backends
+     *  graph_path, checkpoint_path: TensorFlow backend
+     *  @return
+     *  false if the backend cannot be used, the reason is printed
+     */
+    bool load_cnn(CNNBackend backend, const string& weights_path,
+                  const string& graph_path, const string& checkpoint_path);
+
+    //Linear first stage for both classifiers: digits whose top two
+    //logits are at least margin apart are answered by it, only the rest
+    //reach the SVM / CNN. Weights from tools/cascade_train.
+    bool load_cascade(const string& weights_path, float margin = 4.f);
+
+    //Remember the label of every classified digit, keyed by its 28x28
+    //bitmap and the loaded models, so bit identical digits on later pages
+    //skip the classifier. At most entries labels are kept, 0 turns it off.
+    void init_digit_cache(size_t entries);
+
+    //Merge the CNN digits of concurrent tfrecognize_num() calls into
+    //shared runs of up to max_batch digits, started when full or when
+    //the oldest digits have waited max_wait_us. Call after load_cnn(),
+    //max_batch <= 0 turns it off.
+    void enable_batching(int max_batch, int max_wait_us = 2000);
+
+    bool svm_ready() const { return dense_svm.ready() || model != NULL; }
+    bool cnn_ready() const { return cnn_loaded; }
+    CNNBackend backend() const { return cnn_backend; }
+
+    /**
+     *  recognize_num():
+     *  Classify the regions of a page with the SVM.
+     *  @param
+     *  regions: Rect(-1, -1, -1, -1) separates text lines
+     *  @return
+     *  one label per region that is not a separator
+     */
+    vector<int> recognize_num(const CImg<unsigned char>& image, const vector<Rect>& regions) const;
+
+    //Same with the CNN, in batches of at most max_batch digits,
+    //max_batch <= 0 runs the whole page at once
+    vector<int> tfrecognize_num(const CImg<unsigned char>& image, const vector<Rect>& regions,
+                                int max_batch = 128) const;
+
+    //Runs the CNN once per text line instead of once per digit and reads
+    //each digit off the shared feature maps. Approximate, digits are scaled
+    //by the line's median height and see their neighbours instead of
+    //padding. Native float backend only, falls back to tfrecognize_num().
+    vector<int> tfrecognize_lines(const CImg<unsigned char>& image, const vector<Rect>& regions) const;
+
+    //Print how many digits the cascade answered so far
+    void report_cascade(ostream& out = cout) const;
+
+    //Print the cache hit rate so far
+    void report_digit_cache(ostream& out = cout) const;
+
+    //Fill and queueing delay of the merged runs, false without batching
+    bool batching_stats(InferenceBatcher::Stats& stats) const;
+    void report_batching(ostream& out = cout) const;
+
+private:
+
+    //Everything a recognize call writes to
+    struct Workspace {
+        DigitPreprocessor preprocessor;
+        CNN cnn;                            //copy of the loaded one, used by the native backends
+        uint32_t cnn_generation;            //of that copy
+        vector<float> page_batch, batch, features, line, logits;
+        vector<DigitKey> page_keys;
+        vector<pair<int, int> > page_repeats;   //digit, earlier identical digit
+        vector<svm_node> nodes;
+        vector<int> labels;
+    };
+
+    svm_model* model;
+    DenseSVM dense_svm;
+    PCA svm_pca;
+
+    CNN cnn;
+    bool cnn_loaded;
+    CNNBackend cnn_backend;
+#ifndef DIGITSCANNER_NO_TENSORFLOW
+    //The session keeps its input tensors, so runs are serialized
+    mutable Model tf_model;
+    mutable std::mutex tf_lock;
+#endif
+
+    Cascade cascade;
+    mutable std::atomic<long> cascade_digits, cascade_accepted;
+
+    //Thread safe on its own
+    mutable DigitCache digit_cache;
+
+    //Bumped by every model load, so cached labels never outlive their model
+    uint32_t model_generation;
+
+    mutable std::mutex pool_lock;
+    mutable vector<unique_ptr<Workspace> > pool;
+
+    //Declared last, so its thread stops before the models it runs go away
+    CNN batch_cnn;                      //the dispatch thread's copy
+    unique_ptr<InferenceBatcher> batcher;
+
+    unique_ptr<Workspace> acquire() const;
+    void release(unique_ptr<Workspace> ws) const;
+
+    //Labels of n preprocessed digits on the loaded backend, net for the native ones
+    vector<int> run_cnn(CNN& net, const float* input, int n) const;
+
+    uint32_t classifier_version(bool cnn) const { return model_generation * 2 + (cnn ? 1 : 0); }
+
+    vector<int> escalate(Workspace& ws, float* batch, int n, uint32_t version, vector<int>& recognized) const;
+    void remember(Workspace& ws, const vector<int>& escalated, vector<int>& recognized) const;
+
+    TextRecognizer(const TextRecognizer&);
+    TextRecognizer& operator=(const TextRecognizer&);
+};
 
 #endif /* TextRecognition_hpp */
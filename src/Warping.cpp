@@ -1,5 +1,6 @@
 #include "headers.h"
 #include "Warping.h"
+#include "Scheduler.hpp"
 
 using namespace cimg_library;
 using namespace Eigen;
@@ -121,7 +122,7 @@ CImg<unsigned char> Warping::processWithInterpolate() {
 		}
 	}
 
-	if(verbose) img.display();
+	DisplayPolicy(verbose).display(img);
 
 	interpolate();
 
@@ -349,26 +350,28 @@ void Warping::projTransform() {
 
     if(verbose) cout << "The Inverse Projection matrix\n" << PMI << endl;
 
-	//Perform inverse mapping
-	cimg_forXY(warped, x, y) {
+	//Perform inverse mapping, bands of rows in parallel
+	parallel_for(0, warped._height, 16, [&](int y0, int y1) {
+		for (int y = y0; y < y1; y++) for (int x = 0; x < warped._width; x++) {
 
-		//Homogenous coordinates in the warped image
-		Vector3f coords(x, y, 1);
-		//Inverse mapped
-		Vector3f map_coords = PMI * coords;
-		//Projection devide
-		map_coords = map_coords / map_coords[2];
+			//Homogenous coordinates in the warped image
+			Vector3f coords(x, y, 1);
+			//Inverse mapped
+			Vector3f map_coords = PMI * coords;
+			//Projection devide
+			map_coords = map_coords / map_coords[2];
 
 //        cout << map_coords[0] << " " << map_coords[1] << endl;
         
-		if (map_coords[0] >= 0 && map_coords[0] < img._width && 
-			map_coords[1] >= 0 && map_coords[1] < img._height)
-		{
-			warped(x, y, 0) = img(map_coords[0], map_coords[1], 0);
-			warped(x, y, 1) = img(map_coords[0], map_coords[1], 1);
-			warped(x, y, 2) = img(map_coords[0], map_coords[1], 2);
+			if (map_coords[0] >= 0 && map_coords[0] < img._width && 
+				map_coords[1] >= 0 && map_coords[1] < img._height)
+			{
+				warped(x, y, 0) = img(map_coords[0], map_coords[1], 0);
+				warped(x, y, 1) = img(map_coords[0], map_coords[1], 1);
+				warped(x, y, 2) = img(map_coords[0], map_coords[1], 2);
+			}
 		}
-	}
+	});
 
 }
 
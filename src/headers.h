@@ -8,11 +8,16 @@
 #include <cmath>
 #include <numeric>
 
+//Define DIGITSCANNER_NO_TENSORFLOW to build without libtensorflow,
+//the CNN then runs on the native backend only.
+#ifndef DIGITSCANNER_NO_TENSORFLOW
 #include "C_TF.hpp"
+#endif
 
 #define cimg_use_jpeg
+#define cimg_use_png
 #define cimg_verbosity 0
-#include "CImg.h"
+#include "DebugDisplay.hpp"
 
 //Essential to solve X11 conflict with Eigen problem.
 //Ref: http://jasonjuang.blogspot.com/2015/02/how-to-solve-eigen-and-x11-success.html
@@ -21,6 +26,11 @@
 #define EIGEN_USE_BLAS
 #include <Eigen/Dense>
 
+//Row major float matrices and views of plain buffers, as the classifiers store them
+typedef Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> RowMatrixf;
+typedef Eigen::Map<RowMatrixf> MapMatrixf;
+typedef Eigen::Map<const RowMatrixf> ConstMapMatrixf;
+
 /*
 *	A Point in Hough Param Space
 *	Properties:
@@ -4,17 +4,21 @@
 */
 
 #include "headers.h"
-#include "Canny.h"
-#include "Hough_transform.h"
-#include "Warping.h"
-#include "TextDetection.hpp"
-#include "TextRecognition.hpp"
+#include "Scanner.hpp"
+#include "ScanServer.hpp"
 #include "util.h"
+#include "Pipeline.hpp"
+#include "Scheduler.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <dirent.h>
+#include <sys/stat.h>
 
 using namespace cimg_library;
 using namespace std;
 
-//Show verbose info
+//Show verbose info and debug windows
 bool debug_disp = false;
 
 //Canny Parameter
@@ -29,76 +33,401 @@ float thres_fac = 0.3;
 int filter_thres = 200;
 bool do_hist_eq = false;
 
-int main(int argc, char** argv) {
+//Text Detection Parameter
+//Projection profiles instead of connected components, for printed grid forms
+bool use_proj_detection = false;
 
-    if (argc != 4) {
-        cout << "Usage: ./scan input_path output_path txt_output_path" << endl;
-        cout << "Example: ./scan data/input.jpg data/output.jpg output.txt" << endl;
-        return -1;
+//Text Recognition Parameter
+//Convolve whole text lines once instead of every digit crop (native CNN)
+bool use_line_recognition = false;
+//Cheap linear first stage, only digits it is unsure about reach the CNN.
+//Larger margins escalate more digits and lose less accuracy.
+bool use_cascade = false;
+float cascade_margin = 4.f;
+//Reuse labels of bit identical digits, bounded to this many entries
+bool use_digit_cache = false;
+size_t digit_cache_entries = 1 << 16;
+
+//Merge the CNN digits of pages recognized at the same time into shared
+//runs of up to batch_digits, flushed after batch_wait_us at the latest.
+//Pays off with several recognize workers, always on in daemon mode.
+bool use_dynamic_batching = false;
+int batch_digits = 256;
+int batch_wait_us = 2000;
+
+//Threads shared by the parallel kernels, TensorFlow, BLAS and libsvm,
+//0 uses all cores. Pipeline stage workers come on top of it.
+int cpu_threads = 0;
+
+//Batch Parameter
+//Run decode, Canny, Hough, warp, detection, recognition and output as
+//concurrent stages, so different pages overlap
+bool use_pipeline = false;
+//Workers per stage in that order
+int stage_workers[7] = { 1, 2, 2, 1, 1, 1, 1 };
+//Pages waiting in front of each stage, and in flight in total
+size_t stage_queue = 4;
+size_t pipeline_window = 16;
+//Report pages in input order instead of as they finish
+bool ordered_output = true;
+
+//Daemon Parameter
+//Workers per scan stage, decode to recognition
+int serve_stage_workers[6] = { 1, 2, 2, 1, 1, 2 };
+//Per request class, interactive then bulk: pages in the stages at once,
+//requests waiting for admission before new ones are turned away, and
+//the deadline of requests that bring none (0: no deadline)
+int serve_concurrency[2] = { 8, 4 };
+size_t serve_queue[2] = { 32, 256 };
+int serve_deadline_ms[2] = { 5000, 0 };
+//Open connections, more are refused
+int serve_connections = 32;
+
+//Library settings from the parameters above
+static ScanParams scan_params() {
+    
+    ScanParams params;
+    params.gfs = gfs;
+    params.g_sig = g_sig;
+    params.thres_lo = thres_lo;
+    params.thres_hi = thres_hi;
+    params.voting_thres = voting_thres;
+    params.thres_fac = thres_fac;
+    params.filter_thres = filter_thres;
+    params.use_proj_detection = use_proj_detection;
+    params.use_line_recognition = use_line_recognition;
+    params.verbose = debug_disp;
+    return params;
+}
+
+static ServerConfig server_config() {
+    
+    ServerConfig config;
+    std::copy(serve_stage_workers, serve_stage_workers + SCAN_STAGES, config.stage_workers);
+    for (int c = 0; c < REQUEST_CLASSES; c++) {
+        config.classes[c].concurrency = serve_concurrency[c];
+        config.classes[c].queue = serve_queue[c];
+        config.classes[c].deadline_ms = serve_deadline_ms[c];
     }
+    config.max_connections = serve_connections;
+    return config;
+}
 
-    string original_path = string(argv[1]);
-    string out_path = string(argv[2]);
-    string txt_out_path = string(argv[3]);
+static ScannerConfig scanner_config(bool serve) {
     
-    Eigen::initParallel();
+    ScannerConfig config;
+    if (use_line_recognition)
+        config.cnn_backend = CNN_NATIVE;
+    if (use_cascade) {
+        config.cascade_weights = "./model/cascade_weights.bin";
+        config.cascade_margin = cascade_margin;
+    }
+    if (use_digit_cache)
+        config.digit_cache_entries = digit_cache_entries;
+    if (use_dynamic_batching || serve) {
+        config.batch_digits = batch_digits;
+        config.batch_wait_us = batch_wait_us;
+    }
+    return config;
+}
+
+//One page on its way through the steps of Scanner::scan()
+struct PageJob {
+    string path, out_path, txt_out_path;
+    ScanResult scan;
+};
+
+static bool decode_page(PageJob& page) {
     
-    load_tfmodel();
+	//Get image, loaded into the old storage when the size matches
+    try {
+        page.scan.image.load(page.path.c_str());
+    }
+    catch (CImgException&) {
+        cout << "Unable to read " << page.path << endl;
+        return false;
+    }
+    return true;
+}
+
+static bool write_page(PageJob& page, const DisplayPolicy& disp) {
     
-	//Get image, resize
-	CImg<unsigned char> img(original_path.c_str());
-    float resize_fac = img._width / 1000;
-    if (resize_fac == 0) resize_fac = 1;
+    //Writing texts to image
+    ofstream ofs(page.txt_out_path, ofstream::out);
+    ofs << page.scan.text();
+    ofs.close();
     
-	CImg<unsigned char> resized(img);
-	resized.resize(img._width / resize_fac, img._height / resize_fac);
+    page.scan.annotate();
+    disp.display(page.scan.page);
+    page.scan.page.save(page.out_path.c_str());
+    page.scan.page.assign();
+    return true;
+}
 
-	//Perfrom Canny Edge Detection
-	Canny c(resized);
-	c.verbose = debug_disp;
-	CImg<unsigned char> cny = c.process(gfs, g_sig, thres_lo, thres_hi);
+/**
+ *  scan_page():
+ *  Detect, recognize and write out one page.
+ *  @param
+ *  page: paths set, its buffers are reused across pages
+ *  @return
+ *  digits recognized, -1 if the image could not be read or scanned
+ */
+static int scan_page(const Scanner& scanner, const ScanParams& params, PageJob& page, const DisplayPolicy& disp) {
     
-	//Perform Hough Transform and edge extraction
-	Hough_transform ht(img, cny, resize_fac, debug_disp);
-	CImg<unsigned char> result = ht.process(voting_thres, thres_fac, filter_thres);
+    if (!decode_page(page))
+        return -1;
+    try {
+        Scanner::find_edges(page.scan, params);
+        Scanner::find_corners(page.scan, params);
+        if (!Scanner::warp(page.scan, params)) {
+            cout << "No sheet found in " << page.path << endl;
+            return -1;
+        }
+        Scanner::detect(page.scan, params, disp);
+        scanner.recognize(page.scan, params);
+    }
+    catch (CImgException& e) {
+        cout << "Unable to scan " << page.path << ": " << e.what() << endl;
+        return -1;
+    }
+    write_page(page, disp);
+    return (int)page.scan.digits.size();
+}
+
+static bool is_directory(const string& path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
 
-    //Compute Intersects from lines
-	vector<point> intersects = ht.getIntersects();
+//Image files of a directory, sorted by name
+static vector<string> list_directory(const string& dir) {
     
-    //Warp image to 4 corners
-	Warping warp(img, intersects);
-    warp.verbose = debug_disp;
-	CImg<unsigned char> warped_result = warp.processWithProjectionTransform();
+    static const char* extensions[] = { ".jpg", ".jpeg", ".png", ".bmp", ".pgm", ".ppm", ".tif", ".tiff" };
+    vector<string> paths;
+    DIR* d = opendir(dir.c_str());
+    if (d == NULL)
+        return paths;
+    while (struct dirent* entry = readdir(d)) {
+        string name = entry->d_name;
+        size_t dot = name.find_last_of('.');
+        if (name[0] == '.' || dot == string::npos)
+            continue;
+        string ext = name.substr(dot);
+        transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+        for (const char* e : extensions) {
+            if (ext == e) {
+                paths.push_back(dir + "/" + name);
+                break;
+            }
+        }
+    }
+    closedir(d);
+    sort(paths.begin(), paths.end());
+    return paths;
+}
+
+//File name without directory and extension
+static string stem(const string& path) {
+    size_t slash = path.find_last_of('/');
+    string name = slash == string::npos ? path : path.substr(slash + 1);
+    size_t dot = name.find_last_of('.');
+    return dot == string::npos ? name : name.substr(0, dot);
+}
+
+//Page paths from a directory, a file with one path per line, or stdin
+//("-"), which is consumed as it arrives
+class PathSource {
     
-    //Split text regions
-    CImg<unsigned char> eroded = warped_result.get_erode(5);
-    vector<ct::Rect> proposals = text_contourDetection(eroded);
+public:
     
-    //Regocnize texts
-    CImg<unsigned char> less_erode = warped_result.get_erode(3);
-    vector<int> numbers = tfrecognize_num(less_erode, proposals);
+    PathSource() : list(NULL), next_index(0) {}
     
-    //Writing texts to image
-    ofstream ofs(txt_out_path, ofstream::out);
-    for (int i = 0, j = 0; i < proposals.size() && j < numbers.size() ; i++, j++) {
-        ct::Rect& r = proposals[i];
-        if (r.x > 0)
-        {
-            ofs << numbers[j] << " ";
-            unsigned char color = 1;
-            char b[256];
-            sprintf(b, "%d", numbers[j]);
-            less_erode.draw_text(r.x, r.y, b, &color, 0, 1, 23);
-        }
+    bool open(const string& source) {
+        if (source == "-")
+            list = &cin;
+        else if (is_directory(source))
+            listed = list_directory(source);
         else {
-            ofs << endl;
-            j--;
+            file.open(source);
+            if (!file)
+                return false;
+            list = &file;
         }
+        return true;
+    }
+    
+    bool next(string& path) {
+        do {
+            if (list) {
+                if (!getline(*list, path))
+                    return false;
+            }
+            else {
+                if (next_index >= listed.size())
+                    return false;
+                path = listed[next_index++];
+            }
+        } while (path.empty());
+        return true;
+    }
+    
+private:
+    
+    istream* list;
+    ifstream file;
+    vector<string> listed;
+    size_t next_index;
+};
+
+/**
+ *  scan_batch():
+ *  Scan many pages with the models loaded once, one page at a time or
+ *  in the staged pipeline (use_pipeline). page.jpg is written to
+ *  out_dir/page.jpg and out_dir/page.txt, and a "path digits" line is
+ *  printed per page, -1 digits for pages that could not be read or
+ *  scanned. One failed page does not stop the batch.
+ *  @return
+ *  number of pages that failed
+ */
+static int scan_batch(const Scanner& scanner, const ScanParams& params,
+                      const string& source, const string& out_dir, const DisplayPolicy& disp) {
+    
+    PathSource paths;
+    if (!paths.open(source)) {
+        cout << "Unable to open " << source << endl;
+        return 1;
+    }
+    
+    int pages = 0, failed = 0;
+    long digits = 0;
+    auto done = [&](const PageJob& page, bool ok) {
+        cout << page.path << " " << (ok ? (int)page.scan.digits.size() : -1) << endl;
+        if (!ok) {
+            failed++;
+            return;
+        }
+        pages++;
+        digits += page.scan.digits.size();
+    };
+    auto next_page = [&](PageJob& page) {
+        if (!paths.next(page.path))
+            return false;
+        string out = out_dir + "/" + stem(page.path);
+        page.out_path = out + ".jpg";
+        page.txt_out_path = out + ".txt";
+        return true;
+    };
+    
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    
+    if (!use_pipeline) {
+        PageJob page;
+        while (next_page(page)) {
+            done(page, scan_page(scanner, params, page, disp) >= 0);
+        }
+    }
+    else {
+        //Stages run concurrently, so no debug windows
+        DisplayPolicy no_disp(false);
+        Pipeline<PageJob> pipeline(stage_queue, pipeline_window);
+        pipeline.add_stage("decode", stage_workers[0], decode_page);
+        pipeline.add_stage("canny", stage_workers[1], [&](PageJob& page) {
+            Scanner::find_edges(page.scan, params);
+            return true;
+        });
+        pipeline.add_stage("hough", stage_workers[2], [&](PageJob& page) {
+            Scanner::find_corners(page.scan, params);
+            return true;
+        });
+        pipeline.add_stage("warp", stage_workers[3], [&](PageJob& page) {
+            return Scanner::warp(page.scan, params);
+        });
+        pipeline.add_stage("detect", stage_workers[4], [&](PageJob& page) {
+            Scanner::detect(page.scan, params, no_disp);
+            return true;
+        });
+        pipeline.add_stage("recognize", stage_workers[5], [&](PageJob& page) {
+            scanner.recognize(page.scan, params);
+            return true;
+        });
+        pipeline.add_stage("write", stage_workers[6], [&](PageJob& page) { return write_page(page, no_disp); });
+        pipeline.run(next_page, done, ordered_output);
+        
+        const double total = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        printf("stage      workers   pages   busy s  utilization  queue mean  max\n");
+        for (auto& st : pipeline.stats()) {
+            printf("%-10s %7d %7ld %8.2f %11.0f%% %11.2f %4d\n", st.name.c_str(), st.workers, st.jobs, st.busy,
+                   100.0 * st.busy / (total * st.workers), st.mean_depth, (int)st.max_depth);
+        }
+    }
+    
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    cout << pages << " pages, " << digits << " digits in " << elapsed.count() << "s: "
+         << pages / elapsed.count() << " pages/s, " << digits / elapsed.count() << " digits/s";
+    if (failed > 0)
+        cout << ", " << failed << " failed";
+    cout << endl;
+    return failed;
+}
+
+int main(int argc, char** argv) {
+
+    //The mode flag decides which arguments are expected
+    const string mode = argc > 1 ? argv[1] : "";
+    const bool batch = mode == "--batch";
+    const bool serve = mode == "--serve";
+    if (serve && argc != 3) {
+        cout << "Usage: ./scan --serve socket_path" << endl;
+        return -1;
+    }
+    if (batch && argc != 4) {
+        cout << "Usage: ./scan --batch input_dir|path_list|- output_dir" << endl;
+        cout << "Example: ls data/*.jpg | ./scan --batch - out" << endl;
+        return -1;
+    }
+    if (!serve && !batch && argc != 4) {
+        cout << "Usage: ./scan input_path output_path txt_output_path" << endl;
+        cout << "       ./scan --batch input_dir|path_list|- output_dir" << endl;
+        cout << "       ./scan --serve socket_path" << endl;
+        cout << "Example: ./scan data/input.jpg data/output.jpg output.txt" << endl;
+        cout << "         ls data/*.jpg | ./scan --batch - out" << endl;
+        return -1;
+    }
+    
+    DisplayPolicy disp(debug_disp);
+    
+    Eigen::initParallel();
+    set_thread_budget(cpu_threads);
+    
+    //Loaded once, batch and daemon modes reuse them for every page
+    Scanner scanner;
+    if (!scanner.load(scanner_config(serve)))
+        return 255;
+    const ScanParams params = scan_params();
+    
+    int status = 0;
+    if (serve) {
+        ScanServer server(scanner, params, server_config());
+        status = server.serve(argv[2]) ? 0 : 1;
+    }
+    else if (batch) {
+        status = scan_batch(scanner, params, argv[2], argv[3], disp) == 0 ? 0 : 1;
+    }
+    else {
+        PageJob page;
+        page.path = argv[1];
+        page.out_path = argv[2];
+        page.txt_out_path = argv[3];
+        status = scan_page(scanner, params, page, disp) < 0 ? 1 : 0;
+        if (status == 0)
+            cout << page.scan.text() << endl;
     }
-    ofs.close();
     
-    less_erode.display();
-    less_erode.save(out_path.c_str());
+    if (use_cascade)
+        scanner.recognizer().report_cascade();
+    if (use_digit_cache)
+        scanner.recognizer().report_digit_cache();
+    scanner.recognizer().report_batching();
     
-	return 0;
+	return status;
 }
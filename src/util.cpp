@@ -8,7 +8,7 @@
 void Util::DisplayImage(CImg<float>& img) {
 
 	//Display image
-    img.display();
+    DisplayPolicy(true).display(img);
 
 }
 
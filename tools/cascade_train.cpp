@@ -0,0 +1,128 @@
+//
+//  cascade_train.cpp
+//  DigitScanner
+//
+//  Trains the linear first stage of the classifier cascade on MNIST
+//  style idx files and reports, per margin, how many test digits
+//  escalate and how accurate the ones it answers are. With CNN weights
+//  the full cascade is measured against the CNN alone.
+//  Images are binarized at 128 like the scanner's digits.
+//
+//  g++ -O2 -march=native -DDIGITSCANNER_HEADLESS -DDIGITSCANNER_NO_TENSORFLOW -Iinclude -Isrc tools/cascade_train.cpp src/Cascade.cpp src/CNN.cpp src/QGemm.cpp src/FFTConv.cpp -lblas -o bin/cascade_train
+//  ./bin/cascade_train train-images-idx3-ubyte train-labels-idx1-ubyte t10k-images-idx3-ubyte t10k-labels-idx1-ubyte model/cascade_weights.bin model/cnn_weights.bin
+//
+
+#include "headers.h"
+#include "Cascade.hpp"
+#include "CNN.hpp"
+
+#include "mnist_idx.hpp"
+
+#include <chrono>
+#include <stdint.h>
+
+using namespace std;
+
+//CNN over the digits at the given indices, batch at a time
+static void run_cnn(CNN& cnn, const std::vector<float>& images, const std::vector<int>& indices,
+                    int batch, std::vector<float>& buffer, std::vector<int>& predictions) {
+
+    const int n = (int)indices.size();
+    for (int i = 0; i < n; i += batch) {
+        const int b = std::min(batch, n - i);
+        buffer.resize((size_t)b * 784);
+        for (int k = 0; k < b; k++) {
+            memcpy(&buffer[(size_t)k * 784], &images[(size_t)indices[i + k] * 784], 784 * sizeof(float));
+        }
+        std::vector<int> p = cnn.predict(buffer.data(), b);
+        for (int k = 0; k < b; k++) {
+            predictions[indices[i + k]] = p[k];
+        }
+    }
+}
+
+int main(int argc, const char * argv[]) {
+
+    if (argc < 6) {
+        cout << "Usage: cascade_train train-images train-labels test-images test-labels out.bin [cnn_weights.bin] [epochs]" << endl;
+        return 1;
+    }
+    const int epochs = argc > 7 ? atoi(argv[7]) : 10;
+    const int batch = 128;
+
+    std::vector<float> train_images, test_images;
+    std::vector<int> train_labels, test_labels;
+    if (!read_mnist(argv[1], argv[2], train_images, train_labels) ||
+        !read_mnist(argv[3], argv[4], test_images, test_labels)) {
+        return 255;
+    }
+    const int n = (int)test_labels.size();
+
+    Cascade cascade;
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    cascade.train(train_images.data(), train_labels.data(), (int)train_labels.size(), 784, 10, epochs);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - t0;
+    if (!cascade.save(argv[5])) {
+        cout << "Unable to write " << argv[5] << endl;
+        return 255;
+    }
+    printf("trained on %d digits in %.1fs, written to %s\n", (int)train_labels.size(), elapsed.count(), argv[5]);
+
+    CNN cnn;
+    const bool with_cnn = argc > 6 && cnn.load(argv[6]);
+    std::vector<float> buffer;
+    std::vector<int> all(n), cnn_only(n);
+    double cnn_rate = 0;
+    int cnn_correct = 0;
+    if (with_cnn) {
+        for (int i = 0; i < n; i++) all[i] = i;
+        t0 = std::chrono::steady_clock::now();
+        run_cnn(cnn, test_images, all, batch, buffer, cnn_only);
+        elapsed = std::chrono::steady_clock::now() - t0;
+        cnn_rate = n / elapsed.count();
+        for (int i = 0; i < n; i++) cnn_correct += cnn_only[i] == test_labels[i];
+    }
+
+    //Margin 0 answers everything, so its row is the first stage alone
+    const float margins[] = { 0, 1, 2, 4, 6, 8, 12 };
+    printf("margin  escalated  accepted acc   end to end acc  digits/s\n");
+    std::vector<int> predictions(n);
+    std::vector<float> logits;
+    for (float margin : margins) {
+        cascade.margin = margin;
+        t0 = std::chrono::steady_clock::now();
+        std::vector<int> escalated;
+        for (int i = 0; i < n; i += batch) {
+            const int b = std::min(batch, n - i);
+            cascade.classify(&test_images[(size_t)i * 784], b, &predictions[i], logits);
+            for (int k = i; k < i + b; k++) {
+                if (predictions[k] < 0) escalated.push_back(k);
+            }
+        }
+        int accepted = 0, accepted_correct = 0;
+        for (int i = 0; i < n; i++) {
+            if (predictions[i] >= 0) {
+                accepted++;
+                accepted_correct += predictions[i] == test_labels[i];
+            }
+        }
+        if (with_cnn) {
+            run_cnn(cnn, test_images, escalated, batch, buffer, predictions);
+        }
+        elapsed = std::chrono::steady_clock::now() - t0;
+
+        printf("%6.1f  %8.2f%%  ", margin, 100.0 * escalated.size() / n);
+        if (accepted > 0) printf("%12.4f", (double)accepted_correct / accepted);
+        else printf("%12s", "-");
+        if (with_cnn) {
+            int correct = 0;
+            for (int i = 0; i < n; i++) correct += predictions[i] == test_labels[i];
+            printf("  %14.4f  %9.1f", (double)correct / n, n / elapsed.count());
+        }
+        printf("\n");
+    }
+    if (with_cnn) {
+        printf("cnn alone          %21s  %14.4f  %9.1f\n", "", (double)cnn_correct / n, cnn_rate);
+    }
+    return 0;
+}
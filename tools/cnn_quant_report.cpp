@@ -0,0 +1,86 @@
+//
+//  cnn_quant_report.cpp
+//  DigitScanner
+//
+//  Float vs int8 accuracy and throughput of the native CNN on the
+//  MNIST test set (idx files from yann.lecun.com/exdb/mnist).
+//  Images are binarized at 128 like the scanner's digits.
+//
+//  g++ -O2 -march=native -DDIGITSCANNER_HEADLESS -DDIGITSCANNER_NO_TENSORFLOW -Iinclude -Isrc tools/cnn_quant_report.cpp src/CNN.cpp src/QGemm.cpp src/FFTConv.cpp -lblas -o bin/cnn_quant_report
+//  ./bin/cnn_quant_report model/cnn_weights.bin t10k-images-idx3-ubyte t10k-labels-idx1-ubyte
+//
+
+#include "headers.h"
+#include "CNN.hpp"
+#include "QGemm.hpp"
+
+#include "mnist_idx.hpp"
+
+#include <chrono>
+#include <stdint.h>
+
+using namespace std;
+
+//Digits per second and accuracy of one backend over the whole set
+static double run(CNN& cnn, const std::vector<float>& images, const std::vector<unsigned char>& labels,
+                  int batch, std::vector<int>& predictions) {
+
+    const int n = (int)labels.size();
+    predictions.clear();
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int i = 0; i < n; i += batch) {
+        const int b = std::min(batch, n - i);
+        std::vector<int> p = cnn.predict(&images[(size_t)i * 784], b);
+        predictions.insert(predictions.end(), p.begin(), p.end());
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    return n / elapsed.count();
+}
+
+int main(int argc, const char * argv[]) {
+
+    if (argc < 4) {
+        cout << "Usage: cnn_quant_report cnn_weights.bin images-idx3-ubyte labels-idx1-ubyte [batch]" << endl;
+        return 1;
+    }
+    const int batch = argc > 4 ? atoi(argv[4]) : 128;
+
+    CNN cnn;
+    if (!cnn.load(argv[1])) {
+        return 255;
+    }
+    if (!cnn.has_int8()) {
+        cout << "No int8 calibration in " << argv[1] << ", re-export with mnist_train.py" << endl;
+        return 255;
+    }
+
+    std::vector<float> images;
+    std::vector<unsigned char> labels;
+    if (!read_mnist(argv[2], argv[3], images, labels)) {
+        return 255;
+    }
+
+    std::vector<int> pf, pq;
+    cnn.use_int8 = false;
+    const double float_rate = run(cnn, images, labels, batch, pf);
+    cnn.use_int8 = true;
+    const double int8_rate = run(cnn, images, labels, batch, pq);
+
+    int float_correct = 0, int8_correct = 0, agree = 0;
+    for (size_t i = 0; i < labels.size(); i++) {
+        float_correct += pf[i] == labels[i];
+        int8_correct += pq[i] == labels[i];
+        agree += pf[i] == pq[i];
+    }
+
+    const double n = (double)labels.size();
+    printf("images        %d, batch %d, int8 kernel %s\n", (int)labels.size(), batch, qgemm_kernel_name());
+    printf("float convs   %s\n", cnn.conv_algorithms().c_str());
+    printf("float32       accuracy %.4f  %9.1f digits/s\n", float_correct / n, float_rate);
+    printf("int8          accuracy %.4f  %9.1f digits/s\n", int8_correct / n, int8_rate);
+    printf("agreement     %.4f, speedup %.2fx\n", agree / n, int8_rate / float_rate);
+
+    return 0;
+}
@@ -0,0 +1,80 @@
+//
+//  mnist_idx.hpp
+//  DigitScanner
+//
+//  Reader for the MNIST idx files (yann.lecun.com/exdb/mnist) shared by
+//  the training and report tools. Images are binarized at 128 like the
+//  scanner's digits.
+//
+
+#ifndef mnist_idx_hpp
+#define mnist_idx_hpp
+
+#include <stdint.h>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+static inline uint32_t read_be32(std::ifstream& ifs) {
+    unsigned char b[4] = { 0, 0, 0, 0 };
+    ifs.read((char*)b, 4);
+    return ((uint32_t)b[0] << 24) | ((uint32_t)b[1] << 16) | ((uint32_t)b[2] << 8) | b[3];
+}
+
+//Unsigned byte idx file with the given magic, the low byte is the
+//number of dimensions. False unless the header is sane and the file
+//holds every byte it announces.
+static inline bool read_idx(const char* path, uint32_t magic, std::vector<uint32_t>& dims,
+                            std::vector<unsigned char>& data) {
+
+    std::ifstream ifs(path, std::ifstream::binary);
+    if (!ifs || read_be32(ifs) != magic) {
+        return false;
+    }
+    const std::streamoff header = 4 + 4 * (std::streamoff)(magic & 0xff);
+    ifs.seekg(0, std::ifstream::end);
+    const std::streamoff available = ifs.tellg() - header;
+    ifs.seekg(4, std::ifstream::beg);
+
+    dims.clear();
+    size_t size = 1;
+    for (uint32_t i = 0; i < (magic & 0xff); i++) {
+        dims.push_back(read_be32(ifs));
+        if (!ifs || dims.back() == 0 || dims.back() > available / (std::streamoff)size) {
+            return false;
+        }
+        size *= dims.back();
+    }
+    data.resize(size);
+    ifs.read((char*)data.data(), size);
+    return (bool)ifs;
+}
+
+//28x28 images and their 0-9 labels, the reason is printed on failure
+template <typename Label>
+static bool read_mnist(const char* images_path, const char* labels_path,
+                       std::vector<float>& images, std::vector<Label>& labels) {
+
+    std::vector<uint32_t> image_dims, label_dims;
+    std::vector<unsigned char> raw, raw_labels;
+    if (!read_idx(images_path, 0x803, image_dims, raw) || image_dims[1] != 28 || image_dims[2] != 28 ||
+        !read_idx(labels_path, 0x801, label_dims, raw_labels) || label_dims[0] != image_dims[0]) {
+        std::cout << "Unable to read MNIST files " << images_path << " " << labels_path << std::endl;
+        return false;
+    }
+    for (unsigned char l : raw_labels) {
+        if (l > 9) {
+            std::cout << "Label " << (int)l << " out of range in " << labels_path << std::endl;
+            return false;
+        }
+    }
+
+    images.resize(raw.size());
+    for (size_t i = 0; i < raw.size(); i++) {
+        images[i] = raw[i] >= 128 ? 1.f : 0.f;
+    }
+    labels.assign(raw_labels.begin(), raw_labels.end());
+    return true;
+}
+
+#endif /* mnist_idx_hpp */
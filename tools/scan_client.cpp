@@ -0,0 +1,190 @@
+//
+//  scan_client.cpp
+//  DigitScanner
+//
+//  Local client for the scan daemon (./scan --serve socket), standing
+//  in for the upload frontends. Sends each image as bytes, or as a path
+//  the daemon reads itself with --path, and prints the digits. With
+//  -n / -c it replays the images from several connections instead and
+//  prints requests per second and latency percentiles. --bulk sends the
+//  pages as bulk requests, behind any interactive ones, and --deadline
+//  gives up on each page after that many ms.
+//
+//  g++ -O2 -pthread -Isrc tools/scan_client.cpp -o bin/scan_client
+//  ./bin/scan_client /tmp/scan.sock --health
+//  ./bin/scan_client /tmp/scan.sock page1.jpg page2.jpg
+//  ./bin/scan_client /tmp/scan.sock -n 200 -c 8 data/*.jpg
+//  ./bin/scan_client /tmp/scan.sock --bulk -n 1000 -c 4 archive/*.jpg
+//
+
+#include "ScanProtocol.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+typedef std::chrono::steady_clock Clock;
+
+static bool read_file(const string& path, string& data) {
+    ifstream ifs(path, ifstream::binary);
+    if (!ifs)
+        return false;
+    ostringstream buffer;
+    buffer << ifs.rdbuf();
+    data = buffer.str();
+    return true;
+}
+
+//Response payload, false if the connection broke
+static bool request(int fd, const string& payload, string& response) {
+    return write_message(fd, payload) && read_message(fd, response) && !response.empty();
+}
+
+int main(int argc, char** argv) {
+
+    if (argc < 3) {
+        cout << "Usage: scan_client socket --health | --stats" << endl;
+        cout << "       scan_client socket [--path] [--bulk] [--deadline ms] [-n requests -c connections] image..." << endl;
+        return 1;
+    }
+    const string socket_path = argv[1];
+    //A daemon going away shows up as a failed request
+    signal(SIGPIPE, SIG_IGN);
+
+    bool by_path = false, bulk = false;
+    uint32_t deadline_ms = 0;
+    int total = 0, concurrency = 1;
+    char op = 0;
+    vector<string> images;
+    for (int i = 2; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--health")
+            op = SCAN_OP_HEALTH;
+        else if (arg == "--stats")
+            op = SCAN_OP_STATS;
+        else if (arg == "--path")
+            by_path = true;
+        else if (arg == "--bulk")
+            bulk = true;
+        else if (arg == "--deadline" && i + 1 < argc)
+            deadline_ms = (uint32_t)max(0, atoi(argv[++i]));
+        else if (arg == "-n" && i + 1 < argc)
+            total = atoi(argv[++i]);
+        else if (arg == "-c" && i + 1 < argc)
+            concurrency = max(1, atoi(argv[++i]));
+        else
+            images.push_back(arg);
+    }
+
+    //Request payloads, read once up front so the benchmark times the daemon only
+    vector<string> payloads;
+    if (op != 0)
+        payloads.push_back(string(1, op));
+    for (auto& path : images) {
+        string data;
+        if (by_path)
+            data = path;
+        else if (!read_file(path, data)) {
+            cout << "Unable to read " << path << endl;
+            return 1;
+        }
+        const char source = by_path ? SCAN_OP_PATH : SCAN_OP_IMAGE;
+        if (bulk || deadline_ms > 0)
+            payloads.push_back(scan_request(bulk ? SCAN_CLASS_BULK : SCAN_CLASS_INTERACTIVE, deadline_ms, source, data));
+        else
+            payloads.push_back(source + data);
+    }
+    if (payloads.empty())
+        return 0;
+
+    if (total <= 0) {
+        int fd = connect_socket(socket_path);
+        if (fd < 0) {
+            cout << "Unable to connect to " << socket_path << endl;
+            return 1;
+        }
+        int status = 0;
+        for (size_t i = 0; i < payloads.size(); i++) {
+            string response;
+            Clock::time_point t0 = Clock::now();
+            if (!request(fd, payloads[i], response)) {
+                cout << "Connection lost" << endl;
+                status = 1;
+                break;
+            }
+            const double ms = std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+            if (!images.empty() && i >= payloads.size() - images.size())
+                cout << images[i - (payloads.size() - images.size())] << " (" << ms << " ms)" << endl;
+            if (response[0] != SCAN_OK) {
+                cout << "error: ";
+                status = 1;
+            }
+            cout << response.substr(1);
+            if (response.back() != '\n')
+                cout << endl;
+        }
+        close(fd);
+        return status;
+    }
+
+    //Benchmark: connections take the next request until total are sent
+    std::atomic<int> next(0), failed(0), busy(0), expired(0);
+    vector<vector<double> > latencies(concurrency);
+    Clock::time_point start = Clock::now();
+    vector<thread> clients;
+    for (int c = 0; c < concurrency; c++) {
+        clients.push_back(thread([&, c] {
+            int fd = connect_socket(socket_path);
+            if (fd < 0) {
+                failed += total;
+                return;
+            }
+            for (int i = next++; i < total; i = next++) {
+                string response;
+                Clock::time_point t0 = Clock::now();
+                if (!request(fd, payloads[i % payloads.size()], response)) {
+                    failed++;
+                    break;
+                }
+                latencies[c].push_back(std::chrono::duration<double, std::milli>(Clock::now() - t0).count());
+                if (response[0] != SCAN_OK) {
+                    failed++;
+                    if (response.compare(1, string::npos, "busy") == 0)
+                        busy++;
+                    else if (response.compare(1, string::npos, "deadline exceeded") == 0)
+                        expired++;
+                }
+            }
+            close(fd);
+        }));
+    }
+    for (auto& t : clients) {
+        t.join();
+    }
+    const double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+    vector<double> all;
+    for (auto& l : latencies) {
+        all.insert(all.end(), l.begin(), l.end());
+    }
+    sort(all.begin(), all.end());
+    if (all.empty()) {
+        cout << "No responses, is the daemon running on " << socket_path << "?" << endl;
+        return 1;
+    }
+    printf("%d requests over %d connections in %.2fs: %.1f requests/s, %d failed (%d busy, %d expired)\n",
+           (int)all.size(), concurrency, elapsed, all.size() / elapsed, (int)failed, (int)busy, (int)expired);
+    printf("latency ms  p50 %.2f  p90 %.2f  p99 %.2f  max %.2f\n", all[all.size() / 2],
+           all[all.size() * 9 / 10], all[min(all.size() - 1, all.size() * 99 / 100)], all.back());
+    return failed > 0 ? 1 : 0;
+}
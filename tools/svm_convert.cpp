@@ -0,0 +1,56 @@
+//
+//  svm_convert.cpp
+//  DigitScanner
+//
+//  Converts a libsvm text model (model/mnist.model) to the binary
+//  model file DenseSVM maps at startup, and checks the result
+//  loads back.
+//
+//  g++ -O2 -DDIGITSCANNER_HEADLESS -DDIGITSCANNER_NO_TENSORFLOW -Iinclude -Isrc tools/svm_convert.cpp src/DenseSVM.cpp include/svm.cpp -lblas -o bin/svm_convert
+//  ./bin/svm_convert model/mnist.model model/mnist.dsvm
+//
+
+#include "headers.h"
+#include "DenseSVM.hpp"
+#include "DigitPreprocess.hpp"
+
+using namespace std;
+
+int main(int argc, const char * argv[]) {
+
+    if (argc < 3) {
+        cout << "Usage: svm_convert mnist.model mnist.dsvm [dim]" << endl;
+        return 1;
+    }
+    const int dim = argc > 3 ? atoi(argv[3]) : DIGIT_SIZE * DIGIT_SIZE;
+
+    svm_model* model = svm_load_model(argv[1]);
+    if (model == NULL) {
+        cout << "Unable to read libsvm model " << argv[1] << endl;
+        return 255;
+    }
+
+    DenseSVM svm;
+    if (!svm.init(model, dim)) {
+        cout << "Only C_SVC / NU_SVC models with an RBF kernel can be converted." << endl;
+        svm_free_and_destroy_model(&model);
+        return 255;
+    }
+    const int l = svm_get_nr_sv(model);
+    const int nr_class = svm_get_nr_class(model);
+    svm_free_and_destroy_model(&model);
+
+    if (!svm.save(argv[2])) {
+        cout << "Unable to write " << argv[2] << endl;
+        return 255;
+    }
+
+    DenseSVM mapped;
+    if (!mapped.map(argv[2])) {
+        cout << "Written model does not load back " << argv[2] << endl;
+        return 255;
+    }
+
+    cout << argv[2] << ": " << l << " SVs, " << nr_class << " classes, " << dim << " features" << endl;
+    return 0;
+}
@@ -0,0 +1,123 @@
+//
+//  svm_rff_report.cpp
+//  DigitScanner
+//
+//  Accuracy vs digits per second of the SVM classifier on the MNIST
+//  test set (idx files from yann.lecun.com/exdb/mnist): libsvm's
+//  svm_predict, the batched exact RBF, and random Fourier feature
+//  approximations for a few feature counts D.
+//  Images are binarized at 128 like the scanner's digits.
+//
+//  g++ -O2 -march=native -DDIGITSCANNER_HEADLESS -DDIGITSCANNER_NO_TENSORFLOW -Iinclude -Isrc tools/svm_rff_report.cpp src/DenseSVM.cpp include/svm.cpp -lblas -o bin/svm_rff_report
+//  ./bin/svm_rff_report model/mnist.model t10k-images-idx3-ubyte t10k-labels-idx1-ubyte 512 1024 2048
+//
+
+#include "headers.h"
+#include "DenseSVM.hpp"
+
+#include "mnist_idx.hpp"
+
+#include <chrono>
+#include <stdint.h>
+
+using namespace std;
+
+//Digits per second of the batched classifier over the whole set
+static double run(DenseSVM& svm, const std::vector<float>& images, int n, int batch, std::vector<int>& predictions) {
+
+    predictions.clear();
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int i = 0; i < n; i += batch) {
+        const int b = std::min(batch, n - i);
+        std::vector<int> p = svm.predict(&images[(size_t)i * 784], b);
+        predictions.insert(predictions.end(), p.begin(), p.end());
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    return n / elapsed.count();
+}
+
+static void report(const char* name, const std::vector<int>& p, const std::vector<int>& exact,
+                   const std::vector<unsigned char>& labels, double rate) {
+
+    int correct = 0, agree = 0;
+    for (size_t i = 0; i < labels.size(); i++) {
+        correct += p[i] == labels[i];
+        agree += p[i] == exact[i];
+    }
+    const double n = (double)labels.size();
+    printf("%-14s accuracy %.4f  agreement %.4f  %9.1f digits/s\n", name, correct / n, agree / n, rate);
+}
+
+int main(int argc, const char * argv[]) {
+
+    if (argc < 4) {
+        cout << "Usage: svm_rff_report mnist.model|mnist.dsvm images-idx3-ubyte labels-idx1-ubyte [D ...]" << endl;
+        return 1;
+    }
+
+    std::vector<float> images;
+    std::vector<unsigned char> labels;
+    if (!read_mnist(argv[2], argv[3], images, labels)) {
+        return 255;
+    }
+    const int n = (int)labels.size();
+
+    //A binary model maps straight in, a text model also gets timed through libsvm
+    DenseSVM svm;
+    svm_model* model = NULL;
+    if (!svm.map(argv[1])) {
+        model = svm_load_model(argv[1]);
+        if (model == NULL || !svm.init(model, 784)) {
+            cout << "Unable to read an RBF SVM model from " << argv[1] << endl;
+            return 255;
+        }
+    }
+
+    std::vector<int> exact;
+    const double exact_rate = run(svm, images, n, 128, exact);
+
+    printf("images         %d\n", n);
+    if (model != NULL) {
+        std::vector<int> p(n);
+        std::vector<svm_node> nodes(785);
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (int i = 0; i < n; i++) {
+            int k = 0;
+            for (int j = 0; j < 784; j++) {
+                if (images[(size_t)i * 784 + j] != 0) {
+                    nodes[k].index = j;
+                    nodes[k].value = images[(size_t)i * 784 + j];
+                    k++;
+                }
+            }
+            nodes[k].index = -1;
+            p[i] = (int)svm_predict(model, nodes.data());
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        report("svm_predict", p, exact, labels, n / elapsed.count());
+    }
+    report("exact rbf", exact, exact, labels, exact_rate);
+
+    std::vector<int> features;
+    for (int i = 4; i < argc; i++) {
+        features.push_back(atoi(argv[i]));
+    }
+    if (features.empty()) {
+        features = { 256, 512, 1024, 2048, 4096 };
+    }
+    for (size_t i = 0; i < features.size(); i++) {
+        svm.approximate(features[i]);
+        std::vector<int> p;
+        const double rate = run(svm, images, n, 128, p);
+        char name[32];
+        snprintf(name, sizeof(name), "rff D=%d", features[i]);
+        report(name, p, exact, labels, rate);
+    }
+
+    if (model != NULL) {
+        svm_free_and_destroy_model(&model);
+    }
+    return 0;
+}
@@ -0,0 +1,130 @@
+//
+//  svm_train_digits.cpp
+//  DigitScanner
+//
+//  Trains the RBF SVM classifier on MNIST style idx files, optionally
+//  on PCA features. Images are binarized at 128 like the scanner's
+//  digits. With components > 0 the fitted projection is written next
+//  to the model (mnist.model -> mnist.pca), where TextRecognizer::load_svm() picks
+//  it up.
+//
+//  g++ -O2 -march=native -pthread -DDIGITSCANNER_HEADLESS -DDIGITSCANNER_NO_TENSORFLOW -Iinclude -Isrc tools/svm_train_digits.cpp src/PCA.cpp include/svm.cpp -lblas -o bin/svm_train_digits
+//  ./bin/svm_train_digits train-images-idx3-ubyte train-labels-idx1-ubyte model/mnist.model 64
+//
+
+#include "headers.h"
+#include "PCA.hpp"
+#include <svm.h>
+
+#include "mnist_idx.hpp"
+
+#include <chrono>
+#include <stdint.h>
+
+using namespace std;
+
+int main(int argc, const char * argv[]) {
+
+    if (argc < 4) {
+        cout << "Usage: svm_train_digits images-idx3-ubyte labels-idx1-ubyte out.model [components] [C] [gamma]" << endl;
+        cout << "components 0 trains on raw pixels, gamma defaults to 1 / mean squared distance to the mean" << endl;
+        return 1;
+    }
+    const int components = argc > 4 ? atoi(argv[4]) : 64;
+    const double C = argc > 5 ? atof(argv[5]) : 5;
+    double gamma = argc > 6 ? atof(argv[6]) : 0;
+
+    std::vector<float> images;
+    std::vector<unsigned char> labels;
+    if (!read_mnist(argv[1], argv[2], images, labels)) {
+        return 255;
+    }
+    const int n = (int)labels.size();
+
+    //Features, raw pixels or their projection
+    int dim = 784;
+    std::vector<float> features;
+    if (components > 0) {
+        PCA pca;
+        if (!pca.fit(images.data(), n, 784, components)) {
+            cout << "PCA fit failed, components must be 1-784" << endl;
+            return 255;
+        }
+        std::string pca_path = argv[3];
+        const size_t dot = pca_path.find_last_of('.');
+        pca_path = (dot == std::string::npos ? pca_path : pca_path.substr(0, dot)) + ".pca";
+        if (!pca.save(pca_path.c_str())) {
+            cout << "Unable to write " << pca_path << endl;
+            return 255;
+        }
+        dim = components;
+        features.resize((size_t)n * dim);
+        pca.project(images.data(), n, features.data());
+        cout << "PCA " << components << " components written to " << pca_path << endl;
+    }
+    else {
+        features.swap(images);
+    }
+
+    if (gamma <= 0) {
+        Eigen::Map<const Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> > x(features.data(), n, dim);
+        const Eigen::RowVectorXf mean = x.colwise().mean();
+        gamma = n / (x.rowwise() - mean).squaredNorm();
+    }
+
+    //Sparse nodes, zeros skipped
+    std::vector<svm_node> space;
+    std::vector<size_t> start(n);
+    std::vector<double> y(n);
+    for (int i = 0; i < n; i++) {
+        start[i] = space.size();
+        for (int j = 0; j < dim; j++) {
+            const float v = features[(size_t)i * dim + j];
+            if (v != 0) {
+                svm_node node = { j, v };
+                space.push_back(node);
+            }
+        }
+        svm_node end = { -1, 0 };
+        space.push_back(end);
+        y[i] = labels[i];
+    }
+    std::vector<svm_node*> x(n);
+    for (int i = 0; i < n; i++) {
+        x[i] = &space[start[i]];
+    }
+
+    svm_problem prob;
+    prob.l = n;
+    prob.y = y.data();
+    prob.x = x.data();
+
+    svm_parameter param;
+    memset(&param, 0, sizeof(param));
+    param.svm_type = C_SVC;
+    param.kernel_type = RBF;
+    param.gamma = gamma;
+    param.C = C;
+    param.cache_size = 1000;
+    param.eps = 1e-3;
+    param.shrinking = 1;
+    const char* error = svm_check_parameter(&prob, &param);
+    if (error != NULL) {
+        cout << error << endl;
+        return 255;
+    }
+
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    svm_model* model = svm_train(&prob, &param);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - t0;
+
+    if (svm_save_model(argv[3], model) != 0) {
+        cout << "Unable to write " << argv[3] << endl;
+        svm_free_and_destroy_model(&model);
+        return 255;
+    }
+    printf("%d digits, %d features, gamma %g, C %g: %d SVs in %.1fs\n",
+           n, dim, gamma, C, svm_get_nr_sv(model), elapsed.count());
+    svm_free_and_destroy_model(&model);
+    return 0;
+}